@@ -0,0 +1,787 @@
+#include "Ephemeris.h"
+#include "Kepler.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if !defined(VSOP87A_HAS_EARTH) || !defined(VSOP87A_HAS_EMB)
+#error "The ephemeris needs the VSOP87 earth and emb series"
+#endif
+
+// Segments are never split below this length (seconds)
+#define MIN_SEGMENT_LENGTH 60.0
+// Epochs per work item in sun_moon_table
+#define TABLE_BLOCK 256
+
+// Calls f(i) for every i < count, items being handed out to threads as they
+// become free (0 threads for one per core)
+template<typename F>
+static void parallel_for(size_t count, unsigned threads, F f)
+{
+	if(threads == 0)
+	{
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	threads = (unsigned)std::min<size_t>(threads, count);
+
+	std::atomic<size_t> next(0);
+	auto work = [&]()
+	{
+		for(size_t i = next++; i < count; i = next++)
+		{
+			f(i);
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for(unsigned i = 1; i < threads; i++)
+	{
+		pool.emplace_back(work);
+	}
+	work();
+	for(std::thread& th : pool)
+	{
+		th.join();
+	}
+}
+
+// Chebyshev coefficients (n rows of R values) of the samples taken at the n
+// nodes cos(pi (j + 0.5) / n), in the same layout
+template<int R>
+static void chebyshev_coeffs(const double* samples, int n, double* coeffs)
+{
+	for(int k = 0; k < n; k++)
+	{
+		for(int r = 0; r < R; r++)
+		{
+			double c = 0.0;
+			for(int j = 0; j < n; j++)
+			{
+				c += samples[j * R + r] * std::cos(M_PI * k * (j + 0.5) / n);
+			}
+			coeffs[k * R + r] = c * (k == 0 ? 1.0 : 2.0) / n;
+		}
+	}
+}
+
+// Clenshaw recurrence over n rows of R coefficients, x in [-1, 1]
+template<int R>
+static Eigen::Matrix<double, R, 1> clenshaw(const double* coeffs, int n, double x)
+{
+	typedef Eigen::Map<const Eigen::Matrix<double, R, 1>> Row;
+	Eigen::Matrix<double, R, 1> b1 = Eigen::Matrix<double, R, 1>::Zero();
+	Eigen::Matrix<double, R, 1> b2 = Eigen::Matrix<double, R, 1>::Zero();
+	for(int k = n - 1; k >= 1; k--)
+	{
+		Eigen::Matrix<double, R, 1> b0 = Row(coeffs + R * k) + 2.0 * x * b1 - b2;
+		b2 = b1;
+		b1 = b0;
+	}
+	return Row(coeffs) + x * b1 - b2;
+}
+
+// Taylor coefficients in t about x of n rows of R Chebyshev coefficients
+// over a segment of length len, up to order (zero past the degree)
+template<int R>
+static void chebyshev_taylor(const double* coeffs, int n, double x, double len, int order,
+							 Eigen::Matrix<double, R, 1> out[])
+{
+	// Differentiated once per coefficient, each time losing a row
+	std::vector<double> c(coeffs, coeffs + n * R);
+	std::vector<double> d(n * R);
+	double scale = 1.0;
+	for(int k = 0; k <= order; k++)
+	{
+		int m = n - k;
+		if(m <= 0)
+		{
+			out[k].setZero();
+			continue;
+		}
+		out[k] = scale * clenshaw<R>(c.data(), m, x);
+		scale *= 2.0 / len / (double)(k + 1);
+
+		// d_j-1 = d_j+1 + 2 j c_j, the constant term being halved
+		for(int r = 0; r < R; r++)
+		{
+			double d1 = 0.0;
+			double d2 = 0.0;
+			for(int j = m - 1; j >= 1; j--)
+			{
+				double d0 = d2 + 2.0 * (double)j * c[j * R + r];
+				d[(j - 1) * R + r] = d0;
+				d2 = d1;
+				d1 = d0;
+			}
+			d[r] *= 0.5;
+		}
+		std::swap(c, d);
+	}
+}
+
+static const double cos_obliquity = std::cos(OBLIQUITY_J2000 * M_PI / 180.0);
+static const double sin_obliquity = std::sin(OBLIQUITY_J2000 * M_PI / 180.0);
+
+// VSOP87A axes (ecliptic J2000) to the propagator ones (equatorial J2000)
+static void to_equatorial(Eigen::Vector3d& v)
+{
+	double y = v(1);
+	v(1) = cos_obliquity * y - sin_obliquity * v(2);
+	v(2) = sin_obliquity * y + cos_obliquity * v(2);
+}
+
+static void to_equatorial(Eigen::Vector3d& sun, Eigen::Vector3d& moon)
+{
+	to_equatorial(sun);
+	to_equatorial(moon);
+}
+
+// earth and emb are heliocentric, in AU
+static void sun_moon_from_vsop(double earth[], double emb[], Eigen::Vector3d& sun, Eigen::Vector3d& moon)
+{
+	double out_moon[3];
+	vsop87a_large::getMoon(earth, emb, out_moon);
+
+	// From this it's trivial to obtain positions relative to earth in meters
+	sun = -AU_TO_M * Eigen::Vector3d(earth[0], earth[1], earth[2]);
+	moon = AU_TO_M * Eigen::Vector3d(out_moon[0] - earth[0], out_moon[1] - earth[1], out_moon[2] - earth[2]);
+}
+
+void sun_moon_geocentric(double t, Eigen::Vector3d& sun, Eigen::Vector3d& moon, int lunar_terms,
+						 const vsop87a_mixed* mixed)
+{
+	// time is expected in julian millennia
+	double ephT = t / SECONDS_PER_MILLENNIUM;
+
+	if(lunar_terms > 0)
+	{
+		// x, y, z in AU, J2000 sun centered
+		double out_earth[3];
+		vsop87a_large::getEarth(ephT, out_earth, mixed);
+		sun = -AU_TO_M * Eigen::Vector3d(out_earth[0], out_earth[1], out_earth[2]);
+		moon_geocentric(t, moon, lunar_terms);
+		to_equatorial(sun, moon);
+		return;
+	}
+
+	// Earth and EMB share most of their frequencies, so they are evaluated
+	// together (the evaluator keeps scratch buffers, hence one per thread)
+	static const vsop87a_body* const bodies[] = {&vsop87a_large::earth_series, &vsop87a_large::emb_series};
+	thread_local vsop87a_shared shared;
+	thread_local bool shared_ready = false;
+	if(!shared_ready)
+	{
+		shared.init(bodies, 2);
+		shared_ready = true;
+	}
+
+	// x, y, z in AU, J2000 sun centered (earth, then emb)
+	double out[6];
+	shared.get(ephT, out);
+
+	sun_moon_from_vsop(out, out + 3, sun, moon);
+	to_equatorial(sun, moon);
+}
+
+void sun_moon_table(double t0, double h, size_t n, double* out, int lunar_terms, unsigned threads)
+{
+	size_t blocks = (n + TABLE_BLOCK - 1) / TABLE_BLOCK;
+	parallel_for(blocks, threads, [&](size_t block)
+	{
+		size_t first = block * TABLE_BLOCK;
+		size_t m = std::min((size_t)TABLE_BLOCK, n - first);
+
+		// x, y, z in AU, J2000 sun centered, for each epoch (the epochs of a
+		// last, partial block are zero past m)
+		double ephT[TABLE_BLOCK] = {};
+		double earth[3 * TABLE_BLOCK];
+		double emb[3 * TABLE_BLOCK];
+		for(size_t i = 0; i < m; i++)
+		{
+			ephT[i] = (t0 + (double)(first + i) * h) / SECONDS_PER_MILLENNIUM;
+		}
+		vsop87a_large::getEarthBatch(ephT, m, earth);
+		if(lunar_terms <= 0)
+		{
+			vsop87a_large::getEmbBatch(ephT, m, emb);
+		}
+
+		for(size_t i = 0; i < m; i++)
+		{
+			Eigen::Vector3d sun, moon;
+			if(lunar_terms > 0)
+			{
+				sun = -AU_TO_M * Eigen::Vector3d(earth[3 * i], earth[3 * i + 1], earth[3 * i + 2]);
+				moon_geocentric(t0 + (double)(first + i) * h, moon, lunar_terms);
+			}
+			else
+			{
+				sun_moon_from_vsop(earth + 3 * i, emb + 3 * i, sun, moon);
+			}
+			to_equatorial(sun, moon);
+
+			double* row = out + 6 * (first + i);
+			for(int j = 0; j < 3; j++)
+			{
+				row[j] = sun(j);
+				row[j + 3] = moon(j);
+			}
+		}
+	});
+}
+
+ChebyshevEphemeris::ChebyshevEphemeris()
+{
+	segment_length = 86400.0;
+	tolerance = 1.0;
+	degree = 13;
+	lunar_terms = LUNAR_MAX_TERMS;
+	mixed = nullptr;
+	threads = 0;
+	last.t0 = last.t1 = NAN;
+	table_version = vsop87a_large::getTableVersion();
+	unsaved = false;
+	mapping_tried = false;
+	file_times = nullptr;
+	file_coeffs = nullptr;
+	file_count = 0;
+}
+
+void ChebyshevEphemeris::clear()
+{
+	segments.clear();
+	last.t0 = last.t1 = NAN;
+	table_version = vsop87a_large::getTableVersion();
+	unsaved = false;
+	mapping.reset();
+	mapping_tried = false;
+	file_times = nullptr;
+	file_coeffs = nullptr;
+	file_count = 0;
+}
+
+// Everything that changes the fitted values, so a file made with other
+// settings is never used
+static EphemerisFileHeader file_header(const ChebyshevEphemeris& eph)
+{
+	EphemerisFileHeader h;
+	std::memset(&h, 0, sizeof(h));
+	std::memcpy(h.magic, EPHEMERIS_FILE_MAGIC, sizeof(h.magic));
+	h.version = EPHEMERIS_FILE_VERSION;
+	h.frame = EPHEMERIS_FRAME_EQUATORIAL_J2000;
+	h.bodies = EPHEMERIS_BODY_SUN | EPHEMERIS_BODY_MOON;
+	h.degree = eph.degree;
+	h.lunar_terms = eph.lunar_terms;
+	h.segment_length = eph.segment_length;
+	h.tolerance = eph.tolerance;
+	h.vsop_error = vsop87a_large::getTruncationError();
+	h.mixed_au = eph.mixed ? eph.mixed->getThreshold() : 0.0;
+	return h;
+}
+
+bool ChebyshevEphemeris::map_file()
+{
+	mapping_tried = true;
+#if defined(__unix__) || defined(__APPLE__)
+	int fd = open(file.c_str(), O_RDONLY);
+	if(fd < 0)
+	{
+		return false;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(EphemerisFileHeader))
+	{
+		close(fd);
+		return false;
+	}
+	size_t size = (size_t)st.st_size;
+	// Shared and read only, so every process using the file uses the same pages
+	void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED)
+	{
+		return false;
+	}
+	std::shared_ptr<const void> map(data, [size](const void* p){ munmap(const_cast<void*>(p), size); });
+
+	const EphemerisFileHeader* h = (const EphemerisFileHeader*)data;
+	EphemerisFileHeader ours = file_header(*this);
+	size_t rows = (size_t)(degree + 1) * 6;
+	if(std::memcmp(h->magic, ours.magic, sizeof(h->magic)) != 0 || h->version != ours.version ||
+	   h->frame != ours.frame || (h->bodies & ours.bodies) != ours.bodies ||
+	   h->degree != ours.degree || h->lunar_terms != ours.lunar_terms ||
+	   h->segment_length != ours.segment_length || h->tolerance > ours.tolerance ||
+	   h->vsop_error != ours.vsop_error || h->mixed_au != ours.mixed_au ||
+	   size != sizeof(EphemerisFileHeader) + h->segment_count * (2 + rows) * sizeof(double))
+	{
+		return false;
+	}
+
+	mapping = std::move(map);
+	file_count = h->segment_count;
+	file_times = (const double*)(h + 1);
+	file_coeffs = file_times + 2 * file_count;
+
+	// Whatever was fitted here and is in the file too is dropped
+	segments.erase(std::remove_if(segments.begin(), segments.end(), [&](const Segment& s)
+	{
+		SegmentView v;
+		return in_file(0.5 * (s.t0 + s.t1), v);
+	}), segments.end());
+	last.t0 = last.t1 = NAN;
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool ChebyshevEphemeris::save_file()
+{
+#if defined(__unix__) || defined(__APPLE__)
+	// Everything known, from the file and from here, in order
+	std::vector<SegmentView> all;
+	for(size_t i = 0; i < file_count; i++)
+	{
+		all.push_back({file_times[2 * i], file_times[2 * i + 1], file_coeffs + i * (degree + 1) * 6, degree + 1});
+	}
+	for(const Segment& s : segments)
+	{
+		all.push_back(view(s));
+	}
+	std::sort(all.begin(), all.end(), [](const SegmentView& a, const SegmentView& b){ return a.t0 < b.t0; });
+
+	EphemerisFileHeader h = file_header(*this);
+	h.segment_count = all.size();
+	h.t0 = all.empty() ? 0.0 : all.front().t0;
+	h.t1 = all.empty() ? 0.0 : all.back().t1;
+
+	// Written aside and renamed over, so readers see either file whole. Two
+	// processes saving at once keep only the last one's segments, the others
+	// are fitted again when needed.
+	std::string tmp = file + ".tmp." + std::to_string(getpid());
+	std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+	out.write((const char*)&h, sizeof(h));
+	for(const SegmentView& v : all)
+	{
+		double times[2] = {v.t0, v.t1};
+		out.write((const char*)times, sizeof(times));
+	}
+	for(const SegmentView& v : all)
+	{
+		out.write((const char*)v.coeffs, v.n * 6 * sizeof(double));
+	}
+	out.close();
+	if(!out || std::rename(tmp.c_str(), file.c_str()) != 0)
+	{
+		std::remove(tmp.c_str());
+		return false;
+	}
+
+	// The old mapping stays valid until released, even if the file is gone
+	mapping.reset();
+	file_count = 0;
+	return map_file();
+#else
+	return false;
+#endif
+}
+
+ChebyshevEphemeris::Segment ChebyshevEphemeris::fit_segment(double t0, double t1) const
+{
+	Segment seg;
+	seg.t0 = t0;
+	seg.t1 = t1;
+
+	int n = degree + 1;
+	double half = 0.5 * (t1 - t0);
+	double mid = 0.5 * (t1 + t0);
+
+	// Sample at the Chebyshev nodes
+	std::vector<Eigen::Matrix<double, 6, 1>> samples(n);
+	for(int j = 0; j < n; j++)
+	{
+		double x = std::cos(M_PI * (j + 0.5) / n);
+		Eigen::Vector3d sun, moon;
+		sun_moon_geocentric(mid + half * x, sun, moon, lunar_terms, mixed);
+		samples[j] << sun, moon;
+	}
+
+	seg.coeffs.resize(n);
+	chebyshev_coeffs<6>(samples[0].data(), n, seg.coeffs[0].data());
+
+	return seg;
+}
+
+void ChebyshevEphemeris::fit(double t0, double t1, std::vector<Segment>& out) const
+{
+	Segment seg = fit_segment(t0, t1);
+
+	// Check against the full series halfway between the nodes, where the
+	// interpolation error peaks
+	double err = 0.0;
+	int n = degree + 1;
+	for(int j = 0; j < n - 1; j++)
+	{
+		double x = std::cos(M_PI * (j + 1.0) / n);
+		double t = 0.5 * (t1 + t0) + 0.5 * (t1 - t0) * x;
+
+		Eigen::Vector3d sun, moon;
+		sun_moon_geocentric(t, sun, moon, lunar_terms, mixed);
+		Eigen::Matrix<double, 6, 1> fitted = evaluate(view(seg), t);
+
+		err = std::max(err, std::max((sun - fitted.head<3>()).norm(), (moon - fitted.tail<3>()).norm()));
+	}
+
+	if(err > tolerance && t1 - t0 > MIN_SEGMENT_LENGTH)
+	{
+		double mid = 0.5 * (t0 + t1);
+		fit(t0, mid, out);
+		fit(mid, t1, out);
+		return;
+	}
+
+	out.push_back(std::move(seg));
+}
+
+void ChebyshevEphemeris::prepare(double t0, double t1)
+{
+	if(table_version != vsop87a_large::getTableVersion())
+	{
+		clear();
+	}
+	if(!mapping_tried && !file.empty())
+	{
+		map_file();
+	}
+
+	// Blocks not covered yet
+	std::vector<double> missing;
+	double k0 = std::floor(t0 / segment_length);
+	double k1 = std::floor(t1 / segment_length);
+	for(double k = k0; k <= k1; k += 1.0)
+	{
+		SegmentView v;
+		if(!covered(k * segment_length + 0.5 * segment_length, v))
+		{
+			missing.push_back(k);
+		}
+	}
+
+	std::vector<std::vector<Segment>> fitted(missing.size());
+	parallel_for(missing.size(), threads, [&](size_t i)
+	{
+		fit(missing[i] * segment_length, (missing[i] + 1.0) * segment_length, fitted[i]);
+	});
+
+	for(std::vector<Segment>& block : fitted)
+	{
+		std::move(block.begin(), block.end(), std::back_inserter(segments));
+	}
+	std::sort(segments.begin(), segments.end(), [](const Segment& a, const Segment& b){ return a.t0 < b.t0; });
+	last.t0 = last.t1 = NAN;
+
+	if((!missing.empty() || unsaved) && !file.empty())
+	{
+		unsaved = !save_file();
+	}
+}
+
+bool ChebyshevEphemeris::in_file(double t, SegmentView& out) const
+{
+	// Last segment in the file starting at or before t
+	size_t lo = 0, hi = file_count;
+	while(lo < hi)
+	{
+		size_t mid = (lo + hi) / 2;
+		if(file_times[2 * mid] <= t)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	if(lo > 0 && t <= file_times[2 * lo - 1])
+	{
+		out = {file_times[2 * lo - 2], file_times[2 * lo - 1], file_coeffs + (lo - 1) * (degree + 1) * 6, degree + 1};
+		return true;
+	}
+	return false;
+}
+
+bool ChebyshevEphemeris::covered(double t, SegmentView& out) const
+{
+	if(in_file(t, out))
+	{
+		return true;
+	}
+
+	auto it = std::upper_bound(segments.begin(), segments.end(), t,
+							   [](double t, const Segment& s){ return t < s.t0; });
+	if(it != segments.begin() && t <= (it - 1)->t1)
+	{
+		out = view(*(it - 1));
+		return true;
+	}
+	return false;
+}
+
+ChebyshevEphemeris::SegmentView ChebyshevEphemeris::find(double t)
+{
+	// Fitted with other VSOP87 tables (the file is checked again too, its
+	// header holds the truncation and precision it was made with)
+	if(table_version != vsop87a_large::getTableVersion())
+	{
+		clear();
+	}
+	if(last.t0 <= t && t <= last.t1)
+	{
+		return last;
+	}
+	if(!mapping_tried && !file.empty())
+	{
+		map_file();
+	}
+	if(covered(t, last))
+	{
+		return last;
+	}
+
+	// Not covered yet, fit the whole block containing t (only kept in memory,
+	// the file is written by the next prepare)
+	double k = std::floor(t / segment_length);
+	std::vector<Segment> block;
+	fit(k * segment_length, (k + 1.0) * segment_length, block);
+	unsaved = true;
+	auto it = std::upper_bound(segments.begin(), segments.end(), block.front().t0,
+							   [](double t, const Segment& s){ return t < s.t0; });
+	segments.insert(it, std::make_move_iterator(block.begin()), std::make_move_iterator(block.end()));
+	covered(t, last);
+	return last;
+}
+
+ChebyshevEphemeris::SegmentView ChebyshevEphemeris::view(const Segment& seg)
+{
+	static_assert(sizeof(Eigen::Matrix<double, 6, 1>) == 6 * sizeof(double), "Coefficients must be contiguous");
+	return {seg.t0, seg.t1, seg.coeffs[0].data(), (int)seg.coeffs.size()};
+}
+
+Eigen::Matrix<double, 6, 1> ChebyshevEphemeris::evaluate(const SegmentView& seg, double t)
+{
+	double x = (2.0 * t - seg.t0 - seg.t1) / (seg.t1 - seg.t0);
+	return clenshaw<6>(seg.coeffs, seg.n, x);
+}
+
+void ChebyshevEphemeris::sun_moon(double t, Eigen::Vector3d& sun, Eigen::Vector3d& moon)
+{
+	Eigen::Matrix<double, 6, 1> out = evaluate(find(t), t);
+	sun = out.head<3>();
+	moon = out.tail<3>();
+}
+
+double ChebyshevEphemeris::sun_moon_series(double t, int order, Eigen::Vector3d sun[], Eigen::Vector3d moon[])
+{
+	SegmentView seg = find(t);
+	if(seg.t1 <= t)
+	{
+		// t is where the segment ends, and the next one starts
+		seg = find(std::nextafter(t, seg.t1 + segment_length));
+	}
+
+	std::vector<Eigen::Matrix<double, 6, 1>> out(order + 1);
+	double x = (2.0 * t - seg.t0 - seg.t1) / (seg.t1 - seg.t0);
+	chebyshev_taylor<6>(seg.coeffs, seg.n, x, seg.t1 - seg.t0, order, out.data());
+	for(int k = 0; k <= order; k++)
+	{
+		sun[k] = out[k].head<3>();
+		moon[k] = out[k].tail<3>();
+	}
+	return seg.t1;
+}
+
+void StepperEphemeris::init(double t0, double h, int lunar_terms)
+{
+	terms = lunar_terms;
+	earth.init(vsop87a_large::earth_series, t0 / SECONDS_PER_MILLENNIUM, h / SECONDS_PER_MILLENNIUM);
+	if(terms <= 0)
+	{
+		emb.init(vsop87a_large::emb_series, t0 / SECONDS_PER_MILLENNIUM, h / SECONDS_PER_MILLENNIUM);
+	}
+}
+
+void StepperEphemeris::sun_moon(double t, Eigen::Vector3d& sun, Eigen::Vector3d& moon)
+{
+	double out_earth[3];
+	double ephT = t / SECONDS_PER_MILLENNIUM;
+	earth.get(ephT, out_earth);
+
+	if(terms > 0)
+	{
+		sun = -AU_TO_M * Eigen::Vector3d(out_earth[0], out_earth[1], out_earth[2]);
+		moon_geocentric(t, moon, terms);
+		to_equatorial(sun, moon);
+		return;
+	}
+
+	double out_emb[3];
+	emb.get(ephT, out_emb);
+	sun_moon_from_vsop(out_earth, out_emb, sun, moon);
+	to_equatorial(sun, moon);
+}
+
+double planet_mu(Planet p)
+{
+	switch(p)
+	{
+	case Planet::Venus:
+		return MU_VENUS;
+	case Planet::Mars:
+		return MU_MARS;
+	case Planet::Jupiter:
+		return MU_JUPITER;
+	case Planet::Saturn:
+		return MU_SATURN;
+	}
+	return 0.0;
+}
+
+// Heliocentric xyz in AU for each of the n epochs, false if not compiled in
+static bool planet_batch(Planet p, const double* t, size_t n, double* xyz)
+{
+	switch(p)
+	{
+#ifdef VSOP87A_HAS_VENUS
+	case Planet::Venus:
+		vsop87a_large::getVenusBatch(t, n, xyz);
+		return true;
+#endif
+#ifdef VSOP87A_HAS_MARS
+	case Planet::Mars:
+		vsop87a_large::getMarsBatch(t, n, xyz);
+		return true;
+#endif
+#ifdef VSOP87A_HAS_JUPITER
+	case Planet::Jupiter:
+		vsop87a_large::getJupiterBatch(t, n, xyz);
+		return true;
+#endif
+#ifdef VSOP87A_HAS_SATURN
+	case Planet::Saturn:
+		vsop87a_large::getSaturnBatch(t, n, xyz);
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+bool planet_available(Planet p)
+{
+	return planet_batch(p, nullptr, 0, nullptr);
+}
+
+PlanetEphemeris::PlanetEphemeris()
+{
+	last = 0;
+	table_version = vsop87a_large::getTableVersion();
+}
+
+void PlanetEphemeris::clear()
+{
+	segments.clear();
+	last = 0;
+	table_version = vsop87a_large::getTableVersion();
+}
+
+PlanetEphemeris::Segment PlanetEphemeris::fit(double t0) const
+{
+	Segment seg;
+	seg.t0 = t0;
+
+	const int n = PLANET_DEGREE + 1;
+	double ephT[n];
+	double earth[3 * n];
+	double planet[3 * n];
+	for(int j = 0; j < n; j++)
+	{
+		double x = std::cos(M_PI * (j + 0.5) / n);
+		ephT[j] = (t0 + 0.5 * PLANET_SEGMENT_LENGTH * (1.0 + x)) / SECONDS_PER_MILLENNIUM;
+	}
+	vsop87a_large::getEarthBatch(ephT, n, earth);
+
+	for(int p = 0; p < PLANET_COUNT; p++)
+	{
+		if(!planet_batch((Planet)p, ephT, n, planet))
+		{
+			std::fill(&seg.coeffs[p][0][0], &seg.coeffs[p][0][0] + 3 * n, 0.0);
+			continue;
+		}
+		for(int j = 0; j < n; j++)
+		{
+			Eigen::Vector3d pos(planet[3 * j] - earth[3 * j], planet[3 * j + 1] - earth[3 * j + 1],
+								planet[3 * j + 2] - earth[3 * j + 2]);
+			to_equatorial(pos);
+			for(int i = 0; i < 3; i++)
+			{
+				planet[3 * j + i] = AU_TO_M * pos(i);
+			}
+		}
+		chebyshev_coeffs<3>(planet, n, &seg.coeffs[p][0][0]);
+	}
+
+	return seg;
+}
+
+const PlanetEphemeris::Segment& PlanetEphemeris::find(double t)
+{
+	if(table_version != vsop87a_large::getTableVersion())
+	{
+		clear();
+	}
+	if(last < segments.size() && segments[last].t0 <= t && t <= segments[last].t0 + PLANET_SEGMENT_LENGTH)
+	{
+		return segments[last];
+	}
+
+	double t0 = std::floor(t / PLANET_SEGMENT_LENGTH) * PLANET_SEGMENT_LENGTH;
+	auto it = std::lower_bound(segments.begin(), segments.end(), t0,
+							   [](const Segment& s, double t){ return s.t0 < t; });
+	if(it == segments.end() || it->t0 != t0)
+	{
+		it = segments.insert(it, fit(t0));
+	}
+	last = it - segments.begin();
+	return *it;
+}
+
+Eigen::Vector3d PlanetEphemeris::position(Planet p, double t)
+{
+	const Segment& seg = find(t);
+	double x = 2.0 * (t - seg.t0) / PLANET_SEGMENT_LENGTH - 1.0;
+	return clenshaw<3>(&seg.coeffs[(int)p][0][0], PLANET_DEGREE + 1, x);
+}
+
+double PlanetEphemeris::position_series(Planet p, double t, int order, Eigen::Vector3d out[])
+{
+	const Segment* seg = &find(t);
+	if(seg->t0 + PLANET_SEGMENT_LENGTH <= t)
+	{
+		seg = &find(std::nextafter(t, t + PLANET_SEGMENT_LENGTH));
+	}
+	double x = 2.0 * (t - seg->t0) / PLANET_SEGMENT_LENGTH - 1.0;
+	chebyshev_taylor<3>(&seg->coeffs[(int)p][0][0], PLANET_DEGREE + 1, x, PLANET_SEGMENT_LENGTH, order, out);
+	return seg->t0 + PLANET_SEGMENT_LENGTH;
+}
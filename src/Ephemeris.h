@@ -0,0 +1,221 @@
+#pragma once
+#include "Eigen/Dense"
+#include "vsop87a_large.h"
+#include "LunarTheory.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define SECONDS_PER_MILLENNIUM (86400.0 * 365250.0)
+// Mean obliquity of the ecliptic at J2000 in degrees (IAU 1976)
+#define OBLIQUITY_J2000 23.4392911
+
+// Positions of the Sun and the Moon relative to the Earth, in meters, for t in
+// seconds since J2000. Axes are equatorial J2000 like the satellite state (the
+// VSOP87A ecliptic ones turned by OBLIQUITY_J2000 about x), and so are those
+// of every ephemeris below, fitted ones included. The Sun comes from the
+// VSOP87 Earth series and the Moon from moon_geocentric with lunar_terms terms,
+// lunar_terms <= 0 instead takes the Moon as the VSOP87 EMB minus Earth.
+// The Earth series is summed with mixed, if given.
+void sun_moon_geocentric(double t, Eigen::Vector3d& sun, Eigen::Vector3d& moon, int lunar_terms = LUNAR_MAX_TERMS,
+						 const vsop87a_mixed* mixed = nullptr);
+
+// sun_moon_geocentric at t0 + i * h for i < n, in out (n * 6 doubles, epoch
+// major: sun xyz then moon xyz). Epochs are split in blocks over threads (0
+// for one per core), and the Sun comes from the batched VSOP87 kernels.
+void sun_moon_table(double t0, double h, size_t n, double* out, int lunar_terms = LUNAR_MAX_TERMS,
+					unsigned threads = 0);
+
+#define EPHEMERIS_FILE_MAGIC "PROPEPH"
+#define EPHEMERIS_FILE_VERSION 1
+// Axes of the stored positions
+#define EPHEMERIS_FRAME_ECLIPTIC_J2000 0
+#define EPHEMERIS_FRAME_EQUATORIAL_J2000 1
+// Bodies stored, as a mask
+#define EPHEMERIS_BODY_SUN 1
+#define EPHEMERIS_BODY_MOON 2
+
+// Start of a ChebyshevEphemeris file (native byte order). It's followed by
+// t0, t1 for every segment and then by the coefficients of every segment,
+// degree + 1 rows of sun xyz and moon xyz (meters, geocentric) each.
+struct EphemerisFileHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t frame;
+	uint32_t bodies;
+	int32_t degree;
+	int32_t lunar_terms;
+	uint32_t reserved;
+	// Span covered by the segments (seconds since J2000)
+	double t0;
+	double t1;
+	double segment_length;
+	// Fit tolerance (meters), truncation bound of the VSOP87 tables (AU) and
+	// mixed precision threshold (AU) used to make it
+	double tolerance;
+	double vsop_error;
+	double mixed_au;
+	uint64_t segment_count;
+};
+
+// Piecewise Chebyshev fit of sun_moon_geocentric (as done in the JPL DE files).
+// Segments are fitted on first use, each covering at most segment_length seconds,
+// and are halved until the fit is within tolerance of the full series.
+// If file is set, the segments stored there are mapped read-only (and shared
+// between processes), and every prepare that had to fit new blocks rewrites it.
+class ChebyshevEphemeris
+{
+private:
+
+	struct Segment
+	{
+		double t0;
+		double t1;
+		// Coefficients by degree, each one holding sun xyz and moon xyz
+		std::vector<Eigen::Matrix<double, 6, 1>> coeffs;
+	};
+
+	// A segment either fitted here or mapped from the file
+	struct SegmentView
+	{
+		double t0;
+		double t1;
+		// n rows of sun xyz and moon xyz
+		const double* coeffs;
+		int n;
+	};
+
+	// Sorted by time, non overlapping (with each other and with the file)
+	std::vector<Segment> segments;
+	SegmentView last;
+	// Segments were fitted on demand since the file was last written
+	bool unsaved;
+	// vsop87a_large::getTableVersion() of the fits, they are dropped once
+	// the tables change
+	int table_version;
+
+	// Mapped file, if any: t0, t1 of each segment and their coefficients
+	std::shared_ptr<const void> mapping;
+	bool mapping_tried;
+	const double* file_times;
+	const double* file_coeffs;
+	size_t file_count;
+
+	// Appends the segments covering [t0, t1] to out, in order
+	void fit(double t0, double t1, std::vector<Segment>& out) const;
+	Segment fit_segment(double t0, double t1) const;
+	bool in_file(double t, SegmentView& out) const;
+	bool covered(double t, SegmentView& out) const;
+	SegmentView find(double t);
+	static SegmentView view(const Segment& seg);
+	static Eigen::Matrix<double, 6, 1> evaluate(const SegmentView& seg, double t);
+
+	bool map_file();
+	bool save_file();
+
+public:
+
+	// Maximum segment length in seconds
+	double segment_length;
+	// Maximum position error in meters
+	double tolerance;
+	// Degree of the Chebyshev polynomials
+	int degree;
+	// Passed to sun_moon_geocentric, call clear() after changing either
+	int lunar_terms;
+	const vsop87a_mixed* mixed;
+	// Threads used by prepare, 0 for one per core
+	unsigned threads;
+	// Persistent cache, empty for none
+	std::string file;
+
+	// Fits every segment needed to cover [t0, t1], spreading the blocks
+	// over threads. The file is rewritten if that (or an earlier lookup
+	// outside the prepared spans) fitted new ones.
+	void prepare(double t0, double t1);
+	void sun_moon(double t, Eigen::Vector3d& sun, Eigen::Vector3d& moon);
+	// Taylor coefficients of both positions about t (sun[k] multiplies
+	// (t' - t)^k) up to order, from the segment holding t. Returns the end of
+	// that segment, past which they stop following the fit.
+	double sun_moon_series(double t, int order, Eigen::Vector3d sun[], Eigen::Vector3d moon[]);
+	// Also drops the mapping, the file is checked again on next use
+	void clear();
+
+	ChebyshevEphemeris();
+
+};
+
+// sun_moon_geocentric on the uniform grid t0 + i * h (seconds), advancing
+// every VSOP87 term by a rotation instead of evaluating it (the lunar theory
+// is evaluated directly, it's only a hundred terms)
+class StepperEphemeris
+{
+private:
+
+	vsop87a_stepper earth;
+	vsop87a_stepper emb;
+	int terms;
+
+public:
+
+	void init(double t0, double h, int lunar_terms = LUNAR_MAX_TERMS);
+	// Cheap as long as t moves forward along the grid
+	void sun_moon(double t, Eigen::Vector3d& sun, Eigen::Vector3d& moon);
+
+};
+
+// Planets usable as third bodies, each one only if its VSOP87 series are
+// compiled in (see PROPAGATOR_VSOP87_BODIES)
+enum class Planet
+{
+	Venus,
+	Mars,
+	Jupiter,
+	Saturn
+};
+#define PLANET_COUNT 4
+// Chebyshev fits of the planets, 16 day segments of degree 10 are within
+// about 25 m of the series (1e-9 relative at the closest Venus approach)
+#define PLANET_SEGMENT_LENGTH (16.0 * 86400.0)
+#define PLANET_DEGREE 10
+
+// Gravitational parameter in m^3 / s^2
+double planet_mu(Planet p);
+// False if the series of p are not compiled in
+bool planet_available(Planet p);
+
+// Positions of the planets relative to the Earth, in meters.
+// Every available planet is fitted at once on the fixed length segment
+// containing t, the first time it's needed.
+class PlanetEphemeris
+{
+private:
+
+	struct Segment
+	{
+		double t0;
+		// For each planet, PLANET_DEGREE + 1 rows of xyz
+		double coeffs[PLANET_COUNT][PLANET_DEGREE + 1][3];
+	};
+
+	// Sorted by time
+	std::vector<Segment> segments;
+	size_t last;
+	// Like ChebyshevEphemeris::table_version
+	int table_version;
+
+	Segment fit(double t0) const;
+	const Segment& find(double t);
+
+public:
+
+	Eigen::Vector3d position(Planet p, double t);
+	// Like ChebyshevEphemeris::sun_moon_series
+	double position_series(Planet p, double t, int order, Eigen::Vector3d out[]);
+	void clear();
+
+	PlanetEphemeris();
+
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+// Gauss-Jackson (summed Stormer-Cowell and summed Adams) weights, order 8:
+// differences up to the 8th of the accelerations a, that is 9 back points.
+// With s and S the first and second sums of a (s_n = s_n-1 + a_n,
+// S_n = S_n-1 + s_n), the operator identities x = h^2 (log(1 - D))^-2 a and
+// v = h (-log(1 - D))^-1 a (D the backward difference) give
+//   x_n = h^2 (S_n - s_n + sum(G_j D^(j-2) a_n, j >= 2))
+//   v_n = h (s_n + sum(H_j D^(j-1) a_n, j >= 1))
+// with G(t) = (t / log(1 - t))^2 and H(t) = -t / log(1 - t), and shifting by
+// x steps multiplies both by (1 - t)^-x. Below, these are expanded into
+// weights of a_n, a_n-1, ... (newest first), GAUSS_JACKSON_ORDER + 1 of them.
+// The predicted velocity is never needed, f() not depending on it.
+
+// Series of G, for interpolation
+static const double gj_g[11] = {
+	1.0, -1.0, 0.08333333333333333, 0.0, -0.004166666666666667, -0.004166666666666667,
+	-0.003654100529100529, -0.0031415343915343914, -0.0027086089065255733, -0.002355324074074074,
+	-0.0020677822370530705
+};
+
+// Series of H, for interpolation
+static const double gj_h[10] = {
+	1.0, -0.5, -0.08333333333333333, -0.041666666666666664, -0.02638888888888889, -0.01875,
+	-0.014269179894179895, -0.01136739417989418, -0.00935653659611993, -0.00789255401234568
+};
+
+// x_n+1 = h^2 (S_n + sum(w_k a_n-k))
+static const double gj_predict_pos[9] = {
+	0.6500924360169151, -2.416610850569184, 5.432705327080327, -7.982325887846721, 7.879804681236973,
+	-5.207196368446368, 2.217512976992144, -0.5517216309924643, 0.06107264986171236
+};
+
+// x_n+1 = h^2 (S_n + sum(w_k a_n+1-k)), as S_n+1 - s_n+1 = S_n
+static const double gj_correct_pos[9] = {
+	0.06107264986171236, 0.10043858726150393, -0.21799545554753888, 0.3026027386964887,
+	-0.2871720052709636, 0.18465079866121534, -0.07709378006253007, 0.018897581970498636,
+	-0.0020677822370530705
+};
+
+// v_n+1 = h (s_n+1 + sum(w_k a_n+1-k))
+static const double gj_correct_vel[9] = {
+	-0.7130245535714286, 0.5890197861552028, -0.9640148258377425, 1.240890376984127,
+	-1.1405643738977072, 0.7209438381834216, -0.2978546626984127, 0.07249696869488537,
+	-0.00789255401234568
+};
@@ -1,9 +1,14 @@
 #pragma once
 #include "Eigen/Dense"
+#include "SinCos.h"
 
 #define MU 3.9860044188e14
 #define MU_MOON 4.90486959e12
 #define MU_SUN 1.327124400189e20
+#define MU_VENUS 3.24858592e14
+#define MU_MARS 4.282837e13
+#define MU_JUPITER 1.26686534e17
+#define MU_SATURN 3.7931187e16
 #define AU_TO_M 149597870700.0
 // #define J2 1.75553e25 WIKIPEDIA
 // #define J2 1.75162e25 APUNTES
@@ -64,8 +69,10 @@ static KeplerElements euler_to_kepler(const EulerElements<true,has_time>& euler)
 	double dp = euler.vel.dot(euler.pos);
 	out.true_anom = std::atan2(std::sqrt(p / MU) * dp, p - r);
 
-	out.arg_per = std::atan2(euler.pos(2) / std::sin(out.inc),
-							 euler.pos(0) * std::cos(out.raan) + euler.pos(1) * std::sin(out.raan)) - out.true_anom;
+	double sraan, craan;
+	fast_sincos(out.raan, sraan, craan);
+	out.arg_per = std::atan2(euler.pos(2) / fast_sin(out.inc),
+							 euler.pos(0) * craan + euler.pos(1) * sraan) - out.true_anom;
 
 	return out;
 
@@ -106,8 +113,10 @@ static KeplerElements euler_to_kepler_circular(const EulerElements<false, has_ti
 	// Correct quadrant acos
 	out.raan = std::atan2(hv(0), -hv(1));
 
-	out.arg_per = std::atan2(euler.pos(2) / std::sin(out.inc),
-							 euler.pos(0) * std::cos(out.raan) + euler.pos(1) * std::sin(out.raan)) - out.true_anom;
+	double sraan, craan;
+	fast_sincos(out.raan, sraan, craan);
+	out.arg_per = std::atan2(euler.pos(2) / fast_sin(out.inc),
+							 euler.pos(0) * craan + euler.pos(1) * sraan) - out.true_anom;
 
 	return out;
 
@@ -118,28 +127,29 @@ template<bool has_vel>
 static EulerElements<has_vel> kepler_to_euler(const KeplerElements& kepler)
 {
 	double p = kepler.a * (1.0 - kepler.e * kepler.e);
-	double r = p / (1.0 + kepler.e * std::cos(kepler.true_anom));
+	double snu, cnu, sraan, craan, su, cu, si, ci;
+	fast_sincos(kepler.true_anom, snu, cnu);
+	fast_sincos(kepler.raan, sraan, craan);
+	// Argument of latitude
+	fast_sincos(kepler.arg_per + kepler.true_anom, su, cu);
+	fast_sincos(kepler.inc, si, ci);
+
+	double r = p / (1.0 + kepler.e * cnu);
 
 	EulerElements<has_vel> out;
 
-	out.pos(0) = r * (std::cos(kepler.raan) * std::cos(kepler.arg_per + kepler.true_anom)
-			- std::sin(kepler.raan) * std::sin(kepler.arg_per + kepler.true_anom) * std::cos(kepler.inc));
-	out.pos(1) = r * (std::sin(kepler.raan) * std::cos(kepler.arg_per + kepler.true_anom)
-					  + std::cos(kepler.raan) * std::sin(kepler.arg_per + kepler.true_anom) * std::cos(kepler.inc));
-	out.pos(2) = r * (std::sin(kepler.inc) * std::sin(kepler.arg_per + kepler.true_anom));
+	out.pos(0) = r * (craan * cu - sraan * su * ci);
+	out.pos(1) = r * (sraan * cu + craan * su * ci);
+	out.pos(2) = r * (si * su);
 
 	if constexpr (has_vel)
 	{
 		double h = std::sqrt(MU * p);
 
-		double t1 = h * kepler.e / (r * p) * std::sin(kepler.true_anom);
-		out.vel(0) = out.pos(0) * t1 - h / r * (std::cos(kepler.raan) * std::sin(kepler.arg_per + kepler.true_anom) +
-												std::sin(kepler.raan) * std::cos(kepler.arg_per + kepler.true_anom) *
-												std::cos(kepler.inc));
-		out.vel(1) = out.pos(1) * t1 - h / r * (std::sin(kepler.raan) * std::sin(kepler.arg_per + kepler.true_anom) -
-												std::cos(kepler.raan) * std::cos(kepler.arg_per + kepler.true_anom) *
-												std::cos(kepler.inc));
-		out.vel(2) = out.pos(2) * t1 + h / r * std::sin(kepler.inc) * std::cos(kepler.arg_per + kepler.true_anom);
+		double t1 = h * kepler.e / (r * p) * snu;
+		out.vel(0) = out.pos(0) * t1 - h / r * (craan * su + sraan * cu * ci);
+		out.vel(1) = out.pos(1) * t1 - h / r * (sraan * su - craan * cu * ci);
+		out.vel(2) = out.pos(2) * t1 + h / r * si * cu;
 	}
 
 	return out;
@@ -0,0 +1,264 @@
+#include "LunarTheory.h"
+#include "SinCos.h"
+#include <algorithm>
+#include <cmath>
+
+#define DAYS_PER_CENTURY 36525.0
+#define DEGREE (M_PI / 180.0)
+#define ARCSEC_TO_RAD (DEGREE / 3600.0)
+#define MEAN_MOON_DISTANCE 385000.56e3
+
+struct LunarTerm
+{
+	// Multiples of D, M, M', F
+	signed char d, m, mp, f;
+	// Sine coefficient (1e-6 deg) for longitude or latitude, cosine
+	// coefficient (1e-3 km) for distance
+	int a, r;
+};
+
+// Table 47.A, longitude and distance
+static const LunarTerm lr_terms[LUNAR_MAX_TERMS] =
+{
+	{0, 0, 1, 0, 6288774, -20905355},
+	{2, 0, -1, 0, 1274027, -3699111},
+	{2, 0, 0, 0, 658314, -2955968},
+	{0, 0, 2, 0, 213618, -569925},
+	{0, 1, 0, 0, -185116, 48888},
+	{0, 0, 0, 2, -114332, -3149},
+	{2, 0, -2, 0, 58793, 246158},
+	{2, -1, -1, 0, 57066, -152138},
+	{2, 0, 1, 0, 53322, -170733},
+	{2, -1, 0, 0, 45758, -204586},
+	{0, 1, -1, 0, -40923, -129620},
+	{1, 0, 0, 0, -34720, 108743},
+	{0, 1, 1, 0, -30383, 104755},
+	{2, 0, 0, -2, 15327, 10321},
+	{0, 0, 1, 2, -12528, 0},
+	{0, 0, 1, -2, 10980, 79661},
+	{4, 0, -1, 0, 10675, -34782},
+	{0, 0, 3, 0, 10034, -23210},
+	{4, 0, -2, 0, 8548, -21636},
+	{2, 1, -1, 0, -7888, 24208},
+	{2, 1, 0, 0, -6766, 30824},
+	{1, 0, -1, 0, -5163, -8379},
+	{1, 1, 0, 0, 4987, -16675},
+	{2, -1, 1, 0, 4036, -12831},
+	{2, 0, 2, 0, 3994, -10445},
+	{4, 0, 0, 0, 3861, -11650},
+	{2, 0, -3, 0, 3665, 14403},
+	{0, 1, -2, 0, -2689, -7003},
+	{2, 0, -1, 2, -2602, 0},
+	{2, -1, -2, 0, 2390, 10056},
+	{1, 0, 1, 0, -2348, 6322},
+	{2, -2, 0, 0, 2236, -9884},
+	{0, 1, 2, 0, -2120, 5751},
+	{0, 2, 0, 0, -2069, 0},
+	{2, -2, -1, 0, 2048, -4950},
+	{2, 0, 1, -2, -1773, 4130},
+	{2, 0, 0, 2, -1595, 0},
+	{4, -1, -1, 0, 1215, -3958},
+	{0, 0, 2, 2, -1110, 0},
+	{3, 0, -1, 0, -892, 3258},
+	{2, 1, 1, 0, -810, 2616},
+	{4, -1, -2, 0, 759, -1897},
+	{0, 2, -1, 0, -713, -2117},
+	{2, 2, -1, 0, -700, 2354},
+	{2, 1, -2, 0, 691, 0},
+	{2, -1, 0, -2, 596, 0},
+	{4, 0, 1, 0, 549, -1423},
+	{0, 0, 4, 0, 537, -1117},
+	{4, -1, 0, 0, 520, -1571},
+	{1, 0, -2, 0, -487, -1739},
+	{2, 1, 0, -2, -399, 0},
+	{0, 0, 2, -2, -381, -4421},
+	{1, 1, 1, 0, 351, 0},
+	{3, 0, -2, 0, -340, 0},
+	{4, 0, -3, 0, 330, 0},
+	{2, -1, 2, 0, 327, 0},
+	{0, 2, 1, 0, -323, 1165},
+	{1, 1, -1, 0, 299, 0},
+	{2, 0, 3, 0, 294, 0},
+	{2, 0, -1, -2, 0, 8752},
+};
+
+// Table 47.B, latitude (r unused)
+static const LunarTerm b_terms[LUNAR_MAX_TERMS] =
+{
+	{0, 0, 0, 1, 5128122, 0},
+	{0, 0, 1, 1, 280602, 0},
+	{0, 0, 1, -1, 277693, 0},
+	{2, 0, 0, -1, 173237, 0},
+	{2, 0, -1, 1, 55413, 0},
+	{2, 0, -1, -1, 46271, 0},
+	{2, 0, 0, 1, 32573, 0},
+	{0, 0, 2, 1, 17198, 0},
+	{2, 0, 1, -1, 9266, 0},
+	{0, 0, 2, -1, 8822, 0},
+	{2, -1, 0, -1, 8216, 0},
+	{2, 0, -2, -1, 4324, 0},
+	{2, 0, 1, 1, 4200, 0},
+	{2, 1, 0, -1, -3359, 0},
+	{2, -1, -1, 1, 2463, 0},
+	{2, -1, 0, 1, 2211, 0},
+	{2, -1, -1, -1, 2065, 0},
+	{0, 1, -1, -1, -1870, 0},
+	{4, 0, -1, -1, 1828, 0},
+	{0, 1, 0, 1, -1794, 0},
+	{0, 0, 0, 3, -1749, 0},
+	{0, 1, -1, 1, -1565, 0},
+	{1, 0, 0, 1, -1491, 0},
+	{0, 1, 1, 1, -1475, 0},
+	{0, 1, 1, -1, -1410, 0},
+	{0, 1, 0, -1, -1344, 0},
+	{1, 0, 0, -1, -1335, 0},
+	{0, 0, 3, 1, 1107, 0},
+	{4, 0, 0, -1, 1021, 0},
+	{4, 0, -1, 1, 833, 0},
+	{0, 0, 1, -3, 777, 0},
+	{4, 0, -2, 1, 671, 0},
+	{2, 0, 0, -3, 607, 0},
+	{2, 0, 2, -1, 596, 0},
+	{2, -1, 1, -1, 491, 0},
+	{2, 0, -2, 1, -451, 0},
+	{0, 0, 3, -1, 439, 0},
+	{2, 0, 2, 1, 422, 0},
+	{2, 0, -3, -1, 421, 0},
+	{2, 1, -1, 1, -366, 0},
+	{2, 1, 0, 1, -351, 0},
+	{4, 0, 0, 1, 331, 0},
+	{2, -1, 1, 1, 315, 0},
+	{2, -2, 0, -1, 302, 0},
+	{0, 0, 1, 3, -283, 0},
+	{2, 1, 1, -1, -229, 0},
+	{1, 1, 0, -1, 223, 0},
+	{1, 1, 0, 1, 223, 0},
+	{0, 1, -2, -1, -220, 0},
+	{2, 1, -1, -1, -220, 0},
+	{1, 0, 1, 1, -185, 0},
+	{2, -1, -2, -1, 181, 0},
+	{0, 1, 2, 1, -177, 0},
+	{4, 0, -2, -1, 176, 0},
+	{4, -1, -1, -1, 166, 0},
+	{1, 0, 1, -1, -164, 0},
+	{4, 0, 1, -1, 132, 0},
+	{1, 0, -1, -1, -119, 0},
+	{4, -1, 0, -1, 115, 0},
+	{2, -2, 0, 1, 107, 0},
+};
+
+// Polynomial in T (julian centuries), degrees to radians reduced to [0, 2pi)
+static double angle(double a0, double a1, double a2, double a3, double a4, double T)
+{
+	double deg = a0 + T * (a1 + T * (a2 + T * (a3 + T * a4)));
+	deg = std::fmod(deg, 360.0);
+	return (deg < 0.0 ? deg + 360.0 : deg) * DEGREE;
+}
+
+// cos and sin of the argument of a term, from the tables of moon_geocentric
+static void phasor(const LunarTerm& term, const double c[4][9], const double sn[4][9], double& ca, double& sa)
+{
+	int idx[4] = {term.d + 4, term.m + 4, term.mp + 4, term.f + 4};
+	ca = c[0][idx[0]];
+	sa = sn[0][idx[0]];
+	for(int j = 1; j < 4; j++)
+	{
+		double x = ca * c[j][idx[j]] - sa * sn[j][idx[j]];
+		sa = sa * c[j][idx[j]] + ca * sn[j][idx[j]];
+		ca = x;
+	}
+}
+
+void moon_geocentric(double t, Eigen::Vector3d& moon, int terms)
+{
+	terms = std::max(0, std::min(terms, LUNAR_MAX_TERMS));
+	double T = t / (86400.0 * DAYS_PER_CENTURY);
+
+	// Mean longitude, elongation, anomalies of sun and moon, argument of latitude
+	double Lp = angle(218.3164477, 481267.88123421, -0.0015786, 1.0 / 538841.0, -1.0 / 65194000.0, T);
+	double D = angle(297.8501921, 445267.1114034, -0.0018819, 1.0 / 545868.0, -1.0 / 113065000.0, T);
+	double M = angle(357.5291092, 35999.0502909, -0.0001536, 1.0 / 24490000.0, 0.0, T);
+	double Mp = angle(134.9633964, 477198.8675055, 0.0087414, 1.0 / 69699.0, -1.0 / 14712000.0, T);
+	double F = angle(93.2720950, 483202.0175233, -0.0036539, -1.0 / 3526000.0, 1.0 / 863310000.0, T);
+	double A1 = angle(119.75, 131.849, 0.0, 0.0, 0.0, T);
+	double A2 = angle(53.09, 479264.290, 0.0, 0.0, 0.0, T);
+	double A3 = angle(313.45, 481266.484, 0.0, 0.0, 0.0, T);
+	// Decreasing eccentricity of the Earth's orbit
+	double E = 1.0 - 0.002516 * T - 0.0000074 * T * T;
+	double Es[3] = {1.0, E, E * E};
+
+	// Every argument is an integer combination of D, M, M' and F, so the terms
+	// are built by multiplying powers of their phasors instead of calling sin
+	// and cos for each one. Index k holds the phasor of (k - 4) times the angle.
+	double c[4][9], sn[4][9];
+	double base[4] = {D, M, Mp, F};
+	for(int j = 0; j < 4; j++)
+	{
+		c[j][4] = 1.0;
+		sn[j][4] = 0.0;
+		fast_sincos(base[j], sn[j][5], c[j][5]);
+		for(int k = 6; k < 9; k++)
+		{
+			c[j][k] = c[j][k - 1] * c[j][5] - sn[j][k - 1] * sn[j][5];
+			sn[j][k] = sn[j][k - 1] * c[j][5] + c[j][k - 1] * sn[j][5];
+		}
+		for(int k = 0; k < 4; k++)
+		{
+			c[j][k] = c[j][8 - k];
+			sn[j][k] = -sn[j][8 - k];
+		}
+	}
+
+	double sl = 0.0, sr = 0.0, sb = 0.0;
+	for(int i = 0; i < terms; i++)
+	{
+		double e, sa, ca;
+
+		const LunarTerm& a = lr_terms[i];
+		phasor(a, c, sn, ca, sa);
+		e = Es[std::abs(a.m)];
+		sl += e * a.a * sa;
+		sr += e * a.r * ca;
+
+		const LunarTerm& b = b_terms[i];
+		phasor(b, c, sn, ca, sa);
+		sb += Es[std::abs(b.m)] * b.a * sa;
+	}
+
+	// Venus, Jupiter and flattening of the Earth
+	sl += 3958.0 * fast_sin(A1) + 1962.0 * fast_sin(Lp - F) + 318.0 * fast_sin(A2);
+	sb += -2235.0 * fast_sin(Lp) + 382.0 * fast_sin(A3) + 175.0 * fast_sin(A1 - F) + 175.0 * fast_sin(A1 + F)
+			+ 127.0 * fast_sin(Lp - Mp) - 115.0 * fast_sin(Lp + Mp);
+
+	// Mean ecliptic and equinox of date
+	double lambda = Lp + sl * 1e-6 * DEGREE;
+	double beta = sb * 1e-6 * DEGREE;
+	double dist = MEAN_MOON_DISTANCE + sr;
+
+	// Precess back to the ecliptic and equinox of J2000 (Meeus 21.5), from the
+	// epoch T over an interval -T
+	double tt = -T;
+	double eta = ((47.0029 - 0.06603 * T + 0.000598 * T * T) * tt + (-0.03302 + 0.000598 * T) * tt * tt
+			+ 0.000060 * tt * tt * tt) * ARCSEC_TO_RAD;
+	double Pi = 174.876384 * DEGREE + ((3289.4789 + 0.60622 * T) * T
+			- (869.8089 + 0.50491 * T) * tt + 0.03536 * tt * tt) * ARCSEC_TO_RAD;
+	double p = ((5029.0966 + 2.22226 * T - 0.000042 * T * T) * tt + (1.11113 - 0.000042 * T) * tt * tt
+			- 0.000006 * tt * tt * tt) * ARCSEC_TO_RAD;
+
+	double seta, ceta, sbeta, cbeta, spl, cpl;
+	fast_sincos(eta, seta, ceta);
+	fast_sincos(beta, sbeta, cbeta);
+	fast_sincos(Pi - lambda, spl, cpl);
+	double A = ceta * cbeta * spl - seta * sbeta;
+	double B = cbeta * cpl;
+	// sin(beta0), and cos(beta0) >= 0 follows from it
+	double C = ceta * sbeta + seta * cbeta * spl;
+	double lambda0 = p + Pi - std::atan2(A, B);
+	double slambda0, clambda0;
+	fast_sincos(lambda0, slambda0, clambda0);
+	double cbeta0 = std::sqrt(1.0 - C * C);
+
+	moon(0) = dist * cbeta0 * clambda0;
+	moon(1) = dist * cbeta0 * slambda0;
+	moon(2) = dist * C;
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include "Eigen/Dense"
+
+// Truncated ELP2000-82 lunar theory, as given by Meeus (Astronomical Algorithms,
+// chapter 47): 60 periodic terms for longitude and distance, 60 for latitude,
+// good to about 10" in longitude and 4" in latitude.
+#define LUNAR_MAX_TERMS 60
+
+// Geocentric position of the Moon in meters for t in seconds since J2000, in
+// the VSOP87A axes (ecliptic and equinox J2000). Only the first terms of each
+// table (which are sorted by decreasing amplitude) are summed.
+void moon_geocentric(double t, Eigen::Vector3d& moon, int terms = LUNAR_MAX_TERMS);
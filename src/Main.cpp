@@ -1,12 +1,18 @@
 #include "Propagator.h"
 #include "Output.h"
+#include "SimdTier.h"
 #include <iostream>
 
 #define STEP 100000.0
+#ifndef PROPAGATOR_EPHEMERIS_FILE
+#define PROPAGATOR_EPHEMERIS_FILE "ephemeris.bin"
+#endif
 
-int main(void)
+// Optional argument: path of the ephemeris cache file
+int main(int argc, char** argv)
 {
 	std::time_t start_t = std::time(nullptr);
+	std::cout << "Kernels: " << simd_tier_name(simd_tier()) << std::endl;
 
 	Propagator prop;
 	KeplerElements kepler;
@@ -31,6 +37,8 @@ int main(void)
 
 	prop.use_ephemerides = true;
 	prop.use_geopotential = true;
+	prop.integrator = Integrator::DOP853;
+	prop.ephemeris_cache.file = argc > 1 ? argv[1] : PROPAGATOR_EPHEMERIS_FILE;
 
 	clear_file("out.txt");
 	clear_file("out_osc.txt");
@@ -50,5 +58,6 @@ int main(void)
 
 	std::time_t end_t = std::time(nullptr);
 	std::cout << "Simulation took: " << end_t - start_t << "s " << std::endl;
+	std::cout << "Force evaluations per simulated day: " << prop.get_force_evaluations() / (final_length / 86400.0) << std::endl;
 
 }
\ No newline at end of file
@@ -1,24 +1,295 @@
 #include "Propagator.h"
+#include "Dop853.h"
+#include "GaussJackson.h"
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <limits>
 
 
 Propagator::Propagator()
 {
 	use_geopotential = true;
 	use_ephemerides = true;
+	ephemeris_source = EphemerisSource::Chebyshev;
+	active_source = ephemeris_source;
+	lunar_terms = LUNAR_MAX_TERMS;
+	mixed_precision_au = 1e-7;
+	ephemeris_precision = EphemerisPrecision::Double;
+	mixed_t0 = 0.0;
+	memo_hits = 0;
+	memo_misses = 0;
+	force_evaluations = 0;
+	clear_memo();
+	prefetch_ephemerides = false;
+	prefetching = false;
+	use_planets = false;
+	planet_threshold = 1e-12;
+	integrator = Integrator::RK4;
+	abs_tol = 1e-6;
+	rel_tol = 1e-12;
+	adaptive_step = 0.0;
+	adaptive_err = 1e-4;
+	gauss_jackson_corrections = 0;
+	taylor_order = 20;
+	gauss_jackson_table.ready = false;
+	adams_table.ready = false;
+	for(bool& active : planets_active)
+	{
+		active = false;
+	}
+
+}
 
+Propagator::~Propagator()
+{
+	stop_prefetch();
 }
 
-void Propagator::init(double start_time, const EulerElements<true>& initial)
+void Propagator::init(double start_time, const EulerElements<true>& initial, EphemerisPrecision precision)
 {
 	t = start_time;
 	st = 0.0;
 	orbiter_elems = initial;
+	clear_memo();
+	adaptive_step = 0.0;
+	adaptive_err = 1e-4;
+	gauss_jackson_table.ready = false;
+	adams_table.ready = false;
+
+	// Float phases are taken at the start
+	ephemeris_precision = precision;
+	mixed_t0 = start_time / SECONDS_PER_MILLENNIUM;
+	apply_precision();
+}
+
+void Propagator::apply_precision()
+{
+	// Split again if the settings or the active tables changed, dropping what
+	// was evaluated with the old one
+	double au = ephemeris_precision == EphemerisPrecision::Mixed ? mixed_precision_au : 0.0;
+	if(au != mixed_tables.getThreshold() ||
+	   (au > 0.0 && (mixed_t0 != mixed_tables.getStart() || !mixed_tables.current())))
+	{
+		mixed_tables.init(au, mixed_t0);
+		ephemeris_cache.clear();
+		clear_memo();
+	}
+	ephemeris_cache.mixed = au > 0.0 ? &mixed_tables : nullptr;
+}
+
+const Propagator::EphemerisMemo& Propagator::ephemeris_at(double t)
+{
+	if(memo_version != vsop87a_large::getTableVersion())
+	{
+		clear_memo();
+	}
+	for(const EphemerisMemo& m : memo)
+	{
+		if(m.t == t)
+		{
+			memo_hits++;
+			return m;
+		}
+	}
+	memo_misses++;
+
+	EphemerisMemo& m = memo[memo_next];
+	memo_next = (memo_next + 1) % memo.size();
+
+	if(prefetching)
+	{
+		// The producer runs the same epoch sequence, so t is next unless it
+		// finished (or fell out of step), then it's dropped
+		bool ready;
+		while(!(ready = prefetch_ring.pop(m)) && !prefetch_done.load(std::memory_order_acquire))
+		{
+			std::this_thread::yield();
+		}
+		if(!ready)
+		{
+			// Pushed right before finishing
+			ready = prefetch_ring.pop(m);
+		}
+		if(ready && m.t == t)
+		{
+			return m;
+		}
+		stop_prefetch();
+	}
+
+	m.t = t;
+	eval_ephemeris(m);
+	return m;
+}
+
+void Propagator::eval_ephemeris(EphemerisMemo& m)
+{
+	// Positions relative to earth in meters
+	switch(active_source)
+	{
+	case EphemerisSource::Direct:
+		sun_moon_geocentric(m.t, m.sun, m.moon, lunar_terms, ephemeris_cache.mixed);
+		break;
+	case EphemerisSource::Chebyshev:
+		ephemeris_cache.sun_moon(m.t, m.sun, m.moon);
+		break;
+	case EphemerisSource::Stepper:
+		ephemeris_stepper.sun_moon(m.t, m.sun, m.moon);
+		break;
+	}
+
+	// The bodies also attract the Earth, include secondary tidal acceleration
+	double lmoon_pos = m.moon.norm();
+	double lsun_pos = m.sun.norm();
+	m.indirect_acc = -MU_MOON * m.moon / (lmoon_pos * lmoon_pos * lmoon_pos);
+	m.indirect_acc -= MU_SUN * m.sun / (lsun_pos * lsun_pos * lsun_pos);
+
+	for(int p = 0; p < PLANET_COUNT; p++)
+	{
+		if(planets_active[p])
+		{
+			m.planets[p] = planet_ephemeris.position((Planet)p, m.t);
+			double lplanet_pos = m.planets[p].norm();
+			m.indirect_acc -= planet_mu((Planet)p) * m.planets[p] / (lplanet_pos * lplanet_pos * lplanet_pos);
+		}
+	}
+}
+
+void Propagator::gate_planets(double tfor)
+{
+	// Farthest the orbit gets from the Earth (the current distance if unbound)
+	double r = orbiter_elems.pos.norm();
+	double v = orbiter_elems.vel.norm();
+	double energy = v * v / 2.0 - MU / r;
+	double reach = r;
+	if(energy < 0.0)
+	{
+		Eigen::Vector3d e = ((v * v - MU / r) * orbiter_elems.pos -
+							 orbiter_elems.pos.dot(orbiter_elems.vel) * orbiter_elems.vel) / MU;
+		reach = std::max(r, -MU / (2.0 * energy) * (1.0 + e.norm()));
+	}
+
+	bool changed = false;
+	for(int p = 0; p < PLANET_COUNT; p++)
+	{
+		bool active = false;
+		if(use_ephemerides && use_planets && planet_available((Planet)p))
+		{
+			// Closest approach over the call, sampled once per fit segment
+			double d = planet_ephemeris.position((Planet)p, t + tfor).norm();
+			for(double dt = 0.0; dt < tfor; dt += PLANET_SEGMENT_LENGTH)
+			{
+				d = std::min(d, planet_ephemeris.position((Planet)p, t + dt).norm());
+			}
+			// Difference between the pull on the satellite and on the Earth
+			active = 2.0 * planet_mu((Planet)p) * reach / (d * d * d) >= planet_threshold;
+		}
+		changed = changed || active != planets_active[p];
+		planets_active[p] = active;
+	}
+
+	// Memo entries lack the newly active planets
+	if(changed)
+	{
+		clear_memo();
+	}
+}
+
+double Propagator::ephemeris_reach(double tfor, double tstep) const
+{
+	switch(integrator)
+	{
+	case Integrator::GaussJackson:
+		// Starting integrates GAUSS_JACKSON_ORDER steps ahead, and the last
+		// step may end (with its evaluations) a step past the end
+		return t + std::max(tfor, GAUSS_JACKSON_ORDER * tstep) + tstep;
+	case Integrator::Adams:
+		// The step crossing the end, taken as twice the one proposed now (the
+		// most it grows in a step). If it grew more on the way, the rest is
+		// fitted on demand and saved with the next prepare.
+		if(adams_table.ready)
+		{
+			return std::max(t + tfor, adams_table.t0 + adams_table.x) + 2.0 * std::abs(adams_table.h);
+		}
+		return t + tfor + 2.0 * tstep;
+	default:
+		return t + tfor;
+	}
+}
+
+void Propagator::start_prefetch(double t0, double tstep, double tfor)
+{
+	// The first epoch is usually left in the memo by the last chunk
+	bool first = true;
+	for(const EphemerisMemo& m : memo)
+	{
+		first = first && m.t != t0;
+	}
+
+	prefetch_ring.clear();
+	prefetch_stop = false;
+	prefetch_done = false;
+	prefetching = true;
+
+	// Only the producer touches the ephemeris source from here on
+	prefetch_thread = std::thread([this, t0, tstep, tfor, first]()
+	{
+		auto produce = [this](double t)
+		{
+			EphemerisMemo m;
+			m.t = t;
+			eval_ephemeris(m);
+			while(!prefetch_ring.push(m))
+			{
+				if(prefetch_stop.load(std::memory_order_relaxed))
+				{
+					return false;
+				}
+				std::this_thread::yield();
+			}
+			return true;
+		};
+
+		// Same arithmetic as propagate, so the epochs match exactly. The
+		// stage at t + tstep is the next step's first one, so t is only
+		// needed for the very first step.
+		double htstep = tstep * 0.5;
+		double t = t0;
+		bool ok = !first || produce(t);
+		for(double propagated = 0.0; ok && propagated < tfor; propagated += tstep)
+		{
+			ok = produce(t + htstep) && produce(t + tstep);
+			t += tstep;
+		}
+		prefetch_done.store(true, std::memory_order_release);
+	});
+}
+
+void Propagator::stop_prefetch()
+{
+	if(prefetch_thread.joinable())
+	{
+		prefetch_stop = true;
+		prefetch_thread.join();
+	}
+	prefetching = false;
+}
+
+void Propagator::clear_memo()
+{
+	for(EphemerisMemo& m : memo)
+	{
+		m.t = std::numeric_limits<double>::quiet_NaN();
+	}
+	memo_next = 0;
+	memo_version = vsop87a_large::getTableVersion();
 }
 
 template<bool eval_time>
 void Propagator::f(EulerElements<true> &prime, const EulerElements<true> &eval, double t)
 {
+	force_evaluations++;
 	prime.pos = eval.vel;
 
 	// Standard newtonian gravity
@@ -31,40 +302,27 @@ void Propagator::f(EulerElements<true> &prime, const EulerElements<true> &eval,
 	{
 		if(use_ephemerides)
 		{
-			// x, y, z in AU, J2000 sun centered
-			double out_earth[3];
-			double out_emb[3];
-			double out_moon[3];
-			// time is expected in julian centuries
-			double ephT = t / 365250.0;
-			vsop::getEarth(ephT, out_earth);
-			vsop::getEmb(ephT, out_emb);
-			vsop::getMoon(out_earth, out_emb, out_moon);
+			const EphemerisMemo& eph = ephemeris_at(t);
 
-			// (Naming not correct just yet)
-			Eigen::Vector3d sun_pos(out_earth[0], out_earth[1], out_earth[2]);
-			Eigen::Vector3d moon_pos(out_moon[0], out_moon[1], out_moon[2]);
-
-			// From this it's trivial to obtain positions relative to earth in meters
-			moon_pos -= sun_pos;
-			moon_pos *= AU_TO_M;
-			sun_pos *= -AU_TO_M;
-
-			double lmoon_pos = moon_pos.norm();
-			double lsun_pos = sun_pos.norm();
-
-			Eigen::Vector3d sat_to_moon = moon_pos - eval.pos;
-			Eigen::Vector3d sat_to_sun = sun_pos - eval.pos;
+			Eigen::Vector3d sat_to_moon = eph.moon - eval.pos;
+			Eigen::Vector3d sat_to_sun = eph.sun - eval.pos;
 
 			double lsat_to_moon = sat_to_moon.norm();
 			double lsat_to_sun = sat_to_sun.norm();
 			// Newton law on these two bodies
 			ephemeris_acc = MU_MOON * sat_to_moon / (lsat_to_moon * lsat_to_moon * lsat_to_moon);
 			ephemeris_acc += MU_SUN * sat_to_sun / (lsat_to_sun * lsat_to_sun * lsat_to_sun);
-
-			// The bodies also attract the Earth, include secondary tidal acceleration
-			ephemeris_acc -= MU_MOON * moon_pos / (lmoon_pos * lmoon_pos * lmoon_pos);
-			ephemeris_acc -= MU_SUN * sun_pos / (lsun_pos * lsun_pos * lsun_pos);
+			for(int p = 0; p < PLANET_COUNT; p++)
+			{
+				if(planets_active[p])
+				{
+					Eigen::Vector3d sat_to_planet = eph.planets[p] - eval.pos;
+					double lsat_to_planet = sat_to_planet.norm();
+					ephemeris_acc += planet_mu((Planet)p) * sat_to_planet /
+									 (lsat_to_planet * lsat_to_planet * lsat_to_planet);
+				}
+			}
+			ephemeris_acc += eph.indirect_acc;
 		}
 	}
 
@@ -93,12 +351,46 @@ Propagator::set_b(EulerElements<true> &b, const EulerElements<true> &prime, cons
 	b.vel = b0.vel + prime.vel * h;
 }
 
+Propagator::State Propagator::deriv(const State& y, double t)
+{
+	EulerElements<true> eval, prime;
+	eval.pos = y.head<3>();
+	eval.vel = y.tail<3>();
+	f<true>(prime, eval, t);
+
+	State out;
+	out << prime.pos, prime.vel;
+	return out;
+}
+
+Eigen::Vector3d Propagator::acceleration(const Eigen::Vector3d& pos, double t)
+{
+	EulerElements<true> eval, prime;
+	eval.pos = pos;
+	eval.vel.setZero();
+	f<true>(prime, eval, t);
+	return prime.vel;
+}
+
 template<bool use_vel, bool use_time>
-std::vector<EulerElements<use_vel, use_time>> Propagator::propagate(double tfor, double tstep, double sstep)
+static EulerElements<use_vel, use_time> make_sample(const Eigen::Vector3d& pos, const Eigen::Vector3d& vel, double t)
 {
-	std::vector<EulerElements<use_vel, use_time>> out;
-	out.reserve((size_t)std::ceil(tfor / sstep));
+	EulerElements<use_vel, use_time> sample;
+	sample.pos = pos;
+	if constexpr (use_vel)
+	{
+		sample.vel = vel;
+	}
+	if constexpr (use_time)
+	{
+		sample.time = t;
+	}
+	return sample;
+}
 
+template<bool use_vel, bool use_time>
+void Propagator::rk4(std::vector<EulerElements<use_vel, use_time>>& out, double tfor, double tstep, double sstep)
+{
 	double propagated = 0.0;
 	st = 0.0;
 
@@ -125,24 +417,1517 @@ std::vector<EulerElements<use_vel, use_time>> Propagator::propagate(double tfor,
 		st -= tstep;
 		if(st <= 0.0)
 		{
-			EulerElements<use_vel, use_time> sample;
-			sample.pos = orbiter_elems.pos;
-			if constexpr (use_vel)
+			out.push_back(make_sample<use_vel, use_time>(orbiter_elems.pos, orbiter_elems.vel, t));
+			st = sstep;
+		}
+		t += tstep;
+		propagated += tstep;
+	}
+}
+
+// Dormand & Prince (1980) RK5(4) tableau, E being the difference between the
+// 5th and 4th order weights, and D the dense output weights (Hairer's DOPRI5)
+#define DP_A21 (1.0 / 5.0)
+#define DP_A31 (3.0 / 40.0)
+#define DP_A32 (9.0 / 40.0)
+#define DP_A41 (44.0 / 45.0)
+#define DP_A42 (-56.0 / 15.0)
+#define DP_A43 (32.0 / 9.0)
+#define DP_A51 (19372.0 / 6561.0)
+#define DP_A52 (-25360.0 / 2187.0)
+#define DP_A53 (64448.0 / 6561.0)
+#define DP_A54 (-212.0 / 729.0)
+#define DP_A61 (9017.0 / 3168.0)
+#define DP_A62 (-355.0 / 33.0)
+#define DP_A63 (46732.0 / 5247.0)
+#define DP_A64 (49.0 / 176.0)
+#define DP_A65 (-5103.0 / 18656.0)
+#define DP_A71 (35.0 / 384.0)
+#define DP_A73 (500.0 / 1113.0)
+#define DP_A74 (125.0 / 192.0)
+#define DP_A75 (-2187.0 / 6784.0)
+#define DP_A76 (11.0 / 84.0)
+#define DP_C2 (1.0 / 5.0)
+#define DP_C3 (3.0 / 10.0)
+#define DP_C4 (4.0 / 5.0)
+#define DP_C5 (8.0 / 9.0)
+#define DP_E1 (71.0 / 57600.0)
+#define DP_E3 (-71.0 / 16695.0)
+#define DP_E4 (71.0 / 1920.0)
+#define DP_E5 (-17253.0 / 339200.0)
+#define DP_E6 (22.0 / 525.0)
+#define DP_E7 (-1.0 / 40.0)
+#define DP_D1 (-12715105075.0 / 11282082432.0)
+#define DP_D3 (87487479700.0 / 32700410799.0)
+#define DP_D4 (-10690763975.0 / 1880347072.0)
+#define DP_D5 (701980252875.0 / 199316789632.0)
+#define DP_D6 (-1453857185.0 / 822651844.0)
+#define DP_D7 (69997945.0 / 29380423.0)
+
+// PI step size controller (Hairer, Norsett & Wanner II.4): the new step is
+// h * err^-(1/5 - 0.75 beta) * err_old^beta, damped by the safety factor and
+// changed at most by the given factors
+#define DP_BETA 0.04
+#define DP_SAFETY 0.9
+#define DP_MAX_SHRINK 5.0
+#define DP_MAX_GROW 10.0
+
+template<bool use_vel, bool use_time>
+void Propagator::dormand_prince(std::vector<EulerElements<use_vel, use_time>>& out, double tfor, double tstep, double sstep)
+{
+	double t_start = t;
+	double t_end = t + tfor;
+	// Samples are taken at t_start + i * sstep, before t_end
+	size_t next_sample = 0;
+
+	double h = adaptive_step > 0.0 ? adaptive_step : tstep;
+	State y;
+	y << orbiter_elems.pos, orbiter_elems.vel;
+	State k1 = deriv(y, t);
+
+	while(t < t_end)
+	{
+		// The last step ends exactly at t_end, its proposal is kept for the
+		// next call instead of the shortened one
+		bool last = t + h >= t_end;
+		double h_full = h;
+		if(last)
+		{
+			h = t_end - t;
+		}
+
+		State k2 = deriv(y + h * (DP_A21 * k1), t + DP_C2 * h);
+		State k3 = deriv(y + h * (DP_A31 * k1 + DP_A32 * k2), t + DP_C3 * h);
+		State k4 = deriv(y + h * (DP_A41 * k1 + DP_A42 * k2 + DP_A43 * k3), t + DP_C4 * h);
+		State k5 = deriv(y + h * (DP_A51 * k1 + DP_A52 * k2 + DP_A53 * k3 + DP_A54 * k4), t + DP_C5 * h);
+		State k6 = deriv(y + h * (DP_A61 * k1 + DP_A62 * k2 + DP_A63 * k3 + DP_A64 * k4 + DP_A65 * k5), t + h);
+		State y1 = y + h * (DP_A71 * k1 + DP_A73 * k3 + DP_A74 * k4 + DP_A75 * k5 + DP_A76 * k6);
+		State k7 = deriv(y1, t + h);
+
+		State e = h * (DP_E1 * k1 + DP_E3 * k3 + DP_E4 * k4 + DP_E5 * k5 + DP_E6 * k6 + DP_E7 * k7);
+		double err = 0.0;
+		for(int i = 0; i < 6; i++)
+		{
+			double sk = abs_tol + rel_tol * std::max(std::abs(y(i)), std::abs(y1(i)));
+			err += (e(i) / sk) * (e(i) / sk);
+		}
+		err = std::sqrt(err / 6.0);
+
+		double fac11 = std::pow(err, 0.2 - DP_BETA * 0.75);
+		// Written so a NaN error (an overflowing stage) is rejected too
+		if(!(err <= 1.0))
+		{
+			h /= std::min(DP_MAX_SHRINK, fac11 / DP_SAFETY);
+			continue;
+		}
+
+		// Dense output over [t, t + h], only built if a sample falls there
+		double t1 = last ? t_end : t + h;
+		if(t_start + (double)next_sample * sstep < t1)
+		{
+			State r2 = y1 - y;
+			State r3 = h * k1 - r2;
+			State r4 = r2 - h * k7 - r3;
+			State r5 = h * (DP_D1 * k1 + DP_D3 * k3 + DP_D4 * k4 + DP_D5 * k5 + DP_D6 * k6 + DP_D7 * k7);
+			for(double ts = t_start + (double)next_sample * sstep; ts < t1;
+				ts = t_start + (double)++next_sample * sstep)
 			{
-				sample.vel = orbiter_elems.vel;
+				double th = (ts - t) / h;
+				double th1 = 1.0 - th;
+				State ys = y + th * (r2 + th1 * (r3 + th * (r4 + th1 * r5)));
+				out.push_back(make_sample<use_vel, use_time>(ys.head<3>(), ys.tail<3>(), ts));
 			}
-			if constexpr (use_time)
+		}
+
+		double fac = fac11 / std::pow(adaptive_err, DP_BETA);
+		fac = std::max(1.0 / DP_MAX_GROW, std::min(DP_MAX_SHRINK, fac / DP_SAFETY));
+		adaptive_err = std::max(err, 1e-4);
+
+		y = y1;
+		k1 = k7;
+		t = t1;
+		h = last ? std::max(h_full, h / fac) : h / fac;
+	}
+
+	adaptive_step = h;
+	orbiter_elems.pos = y.head<3>();
+	orbiter_elems.vel = y.tail<3>();
+}
+
+// DOP853 step size control (Hairer's defaults): the new step is
+// h * err^(-1/8), damped by the safety factor and changed at most by the
+// given factors
+#define DOP853_SAFETY 0.9
+#define DOP853_MAX_SHRINK 3.0
+#define DOP853_MAX_GROW 6.0
+
+template<bool use_vel, bool use_time>
+void Propagator::dop853(std::vector<EulerElements<use_vel, use_time>>& out, double tfor, double tstep, double sstep)
+{
+	double t_start = t;
+	double t_end = t + tfor;
+	// Samples are taken at t_start + i * sstep, before t_end
+	size_t next_sample = 0;
+
+	double h = adaptive_step > 0.0 ? adaptive_step : tstep;
+	State y;
+	y << orbiter_elems.pos, orbiter_elems.vel;
+	State k[16];
+	k[0] = deriv(y, t);
+
+	while(t < t_end)
+	{
+		// The last step ends exactly at t_end, its proposal is kept for the
+		// next call instead of the shortened one
+		bool last = t + h >= t_end;
+		double h_full = h;
+		if(last)
+		{
+			h = t_end - t;
+		}
+
+		for(int s = 1; s < 12; s++)
+		{
+			State dy = State::Zero();
+			for(int j = 0; j < s; j++)
 			{
-				sample.time = t;
+				dy += dop853_a[s][j] * k[j];
 			}
-			out.push_back(sample);
-			st = sstep;
+			k[s] = deriv(y + h * dy, t + dop853_c[s] * h);
 		}
-		t += tstep;
-		propagated += tstep;
+		State dy = State::Zero();
+		for(int j = 0; j < 12; j++)
+		{
+			dy += dop853_a[12][j] * k[j];
+		}
+		State y1 = y + h * dy;
+
+		// The 3rd order estimate keeps the 5th order one from being too
+		// optimistic
+		double err5 = 0.0;
+		double err3 = 0.0;
+		for(int i = 0; i < 6; i++)
+		{
+			double sk = abs_tol + rel_tol * std::max(std::abs(y(i)), std::abs(y1(i)));
+			double e5 = 0.0;
+			double e3 = 0.0;
+			for(int j = 0; j < 12; j++)
+			{
+				e5 += dop853_e5[j] * k[j](i);
+				e3 += dop853_e3[j] * k[j](i);
+			}
+			err5 += (e5 / sk) * (e5 / sk);
+			err3 += (e3 / sk) * (e3 / sk);
+		}
+		double denom = err5 + 0.01 * err3;
+		double err = denom > 0.0 ? h * err5 / std::sqrt(denom * 6.0) : 0.0;
+
+		double fac11 = std::pow(err, 1.0 / 8.0);
+		if(!(err <= 1.0))
+		{
+			h /= std::min(DOP853_MAX_SHRINK, fac11 / DOP853_SAFETY);
+			continue;
+		}
+		k[12] = deriv(y1, t + h);
+
+		// Dense output over [t, t + h], only built if a sample falls there
+		double t1 = last ? t_end : t + h;
+		if(t_start + (double)next_sample * sstep < t1)
+		{
+			for(int s = 13; s < 16; s++)
+			{
+				State dy = State::Zero();
+				for(int j = 0; j < s; j++)
+				{
+					dy += dop853_a[s][j] * k[j];
+				}
+				k[s] = deriv(y + h * dy, t + dop853_c[s] * h);
+			}
+
+			State r[7];
+			r[0] = y1 - y;
+			r[1] = h * k[0] - r[0];
+			r[2] = 2.0 * r[0] - h * (k[12] + k[0]);
+			for(int i = 0; i < 4; i++)
+			{
+				r[3 + i].setZero();
+				for(int j = 0; j < 16; j++)
+				{
+					r[3 + i] += dop853_d[i][j] * k[j];
+				}
+				r[3 + i] *= h;
+			}
+
+			for(double ts = t_start + (double)next_sample * sstep; ts < t1;
+				ts = t_start + (double)++next_sample * sstep)
+			{
+				// x (r0 + (1 - x) (r1 + x (r2 + (1 - x) (...))))
+				double x = (ts - t) / h;
+				State ys = State::Zero();
+				for(int i = 6; i >= 0; i--)
+				{
+					ys = (ys + r[i]) * (i % 2 == 0 ? x : 1.0 - x);
+				}
+				ys += y;
+				out.push_back(make_sample<use_vel, use_time>(ys.head<3>(), ys.tail<3>(), ts));
+			}
+		}
+
+		double fac = std::max(1.0 / DOP853_MAX_GROW, std::min(DOP853_MAX_SHRINK, fac11 / DOP853_SAFETY));
+
+		y = y1;
+		k[0] = k[12];
+		t = t1;
+		h = last ? std::max(h_full, h / fac) : h / fac;
+	}
+
+	adaptive_step = h;
+	orbiter_elems.pos = y.head<3>();
+	orbiter_elems.vel = y.tail<3>();
+}
+
+// Nystrom's 5th order method (Hairer, Norsett & Wanner I, table II.14.3) for
+// x'' = a(x): stage positions are x + c h v + h^2 sum(A a), the new position
+// x + h v + h^2 sum(BP a) and the new velocity v + h sum(BV a)
+static const double rkn_c[4] = {0.0, 1.0 / 5.0, 2.0 / 3.0, 1.0};
+static const double rkn_a[4][3] = {
+	{0.0, 0.0, 0.0},
+	{1.0 / 50.0, 0.0, 0.0},
+	{-1.0 / 27.0, 7.0 / 27.0, 0.0},
+	{3.0 / 10.0, -2.0 / 35.0, 9.0 / 35.0}
+};
+static const double rkn_bp[4] = {14.0 / 336.0, 100.0 / 336.0, 54.0 / 336.0, 0.0};
+static const double rkn_bv[4] = {14.0 / 336.0, 125.0 / 336.0, 162.0 / 336.0, 35.0 / 336.0};
+// BP minus the weights of a 4th order position formula that also uses a at
+// the new point (the fifth entry). The family of those is BP + d (-2, 25/7,
+// -18/7, 0, 1), d = 1/20 is taken.
+static const double rkn_e[5] = {2.0 / 20.0, -25.0 / 140.0, 18.0 / 140.0, 0.0, -1.0 / 20.0};
+
+// Quintic Hermite interpolation at x (0 to 1) of the step of length h from
+// p0, v0, a0 to p1, v1, a1
+static void hermite(double x, double h, const Eigen::Vector3d& p0, const Eigen::Vector3d& v0, const Eigen::Vector3d& a0,
+					const Eigen::Vector3d& p1, const Eigen::Vector3d& v1, const Eigen::Vector3d& a1,
+					Eigen::Vector3d& p, Eigen::Vector3d& v)
+{
+	double x2 = x * x;
+	double x3 = x2 * x;
+	double x4 = x3 * x;
+	double x5 = x4 * x;
+
+	double hp1 = 10.0 * x3 - 15.0 * x4 + 6.0 * x5;
+	double hv0 = x - 6.0 * x3 + 8.0 * x4 - 3.0 * x5;
+	double hv1 = -4.0 * x3 + 7.0 * x4 - 3.0 * x5;
+	double ha0 = 0.5 * x2 - 1.5 * x3 + 1.5 * x4 - 0.5 * x5;
+	double ha1 = 0.5 * x3 - x4 + 0.5 * x5;
+	p = (1.0 - hp1) * p0 + hp1 * p1 + h * (hv0 * v0 + hv1 * v1) + h * h * (ha0 * a0 + ha1 * a1);
+
+	double dp1 = 30.0 * x2 - 60.0 * x3 + 30.0 * x4;
+	double dv0 = 1.0 - 18.0 * x2 + 32.0 * x3 - 15.0 * x4;
+	double dv1 = -12.0 * x2 + 28.0 * x3 - 15.0 * x4;
+	double da0 = x - 4.5 * x2 + 6.0 * x3 - 2.5 * x4;
+	double da1 = 1.5 * x2 - 4.0 * x3 + 2.5 * x4;
+	v = dp1 * (p1 - p0) / h + dv0 * v0 + dv1 * v1 + h * (da0 * a0 + da1 * a1);
+}
+
+template<bool use_vel, bool use_time>
+void Propagator::nystrom(std::vector<EulerElements<use_vel, use_time>>& out, double tfor, double tstep, double sstep)
+{
+	double t_start = t;
+	double t_end = t + tfor;
+	// Samples are taken at t_start + i * sstep, before t_end
+	size_t next_sample = 0;
+
+	double h = adaptive_step > 0.0 ? adaptive_step : tstep;
+	Eigen::Vector3d x = orbiter_elems.pos;
+	Eigen::Vector3d v = orbiter_elems.vel;
+	// Stage accelerations, the last one being at the new point
+	Eigen::Vector3d a[5];
+	a[0] = acceleration(x, t);
+
+	while(t < t_end)
+	{
+		// The last step ends exactly at t_end, its proposal is kept for the
+		// next call instead of the shortened one
+		bool last = t + h >= t_end;
+		double h_full = h;
+		if(last)
+		{
+			h = t_end - t;
+		}
+
+		for(int s = 1; s < 4; s++)
+		{
+			Eigen::Vector3d xs = x + rkn_c[s] * h * v;
+			for(int j = 0; j < s; j++)
+			{
+				xs += h * h * rkn_a[s][j] * a[j];
+			}
+			a[s] = acceleration(xs, t + rkn_c[s] * h);
+		}
+		Eigen::Vector3d x1 = x + h * v;
+		Eigen::Vector3d v1 = v;
+		for(int j = 0; j < 4; j++)
+		{
+			x1 += h * h * rkn_bp[j] * a[j];
+			v1 += h * rkn_bv[j] * a[j];
+		}
+		a[4] = acceleration(x1, t + h);
+
+		Eigen::Vector3d e = Eigen::Vector3d::Zero();
+		for(int j = 0; j < 5; j++)
+		{
+			e += rkn_e[j] * a[j];
+		}
+		e *= h * h;
+		double err = 0.0;
+		for(int i = 0; i < 3; i++)
+		{
+			double sk = abs_tol + rel_tol * std::max(std::abs(x(i)), std::abs(x1(i)));
+			err += (e(i) / sk) * (e(i) / sk);
+		}
+		err = std::sqrt(err / 3.0);
+
+		// Same controller as Dormand-Prince, the estimate being of the same order
+		double fac11 = std::pow(err, 0.2 - DP_BETA * 0.75);
+		if(!(err <= 1.0))
+		{
+			h /= std::min(DP_MAX_SHRINK, fac11 / DP_SAFETY);
+			continue;
+		}
+
+		double t1 = last ? t_end : t + h;
+		for(double ts = t_start + (double)next_sample * sstep; ts < t1;
+			ts = t_start + (double)++next_sample * sstep)
+		{
+			Eigen::Vector3d ps, vs;
+			hermite((ts - t) / h, h, x, v, a[0], x1, v1, a[4], ps, vs);
+			out.push_back(make_sample<use_vel, use_time>(ps, vs, ts));
+		}
+
+		double fac = fac11 / std::pow(adaptive_err, DP_BETA);
+		fac = std::max(1.0 / DP_MAX_GROW, std::min(DP_MAX_SHRINK, fac / DP_SAFETY));
+		adaptive_err = std::max(err, 1e-4);
+
+		x = x1;
+		v = v1;
+		a[0] = a[4];
+		t = t1;
+		h = last ? std::max(h_full, h / fac) : h / fac;
+	}
+
+	adaptive_step = h;
+	orbiter_elems.pos = x;
+	orbiter_elems.vel = v;
+}
+
+void Propagator::gauss_jackson_sums(const Eigen::Vector3d& x, const Eigen::Vector3d& v)
+{
+	// The corrector formulas solved for the sums
+	GaussJacksonTable& g = gauss_jackson_table;
+	g.s = v / g.h;
+	for(int k = 0; k <= GAUSS_JACKSON_ORDER; k++)
+	{
+		g.s -= gj_correct_vel[k] * g.a[k];
+	}
+	g.S = x / (g.h * g.h) + g.s;
+	for(int k = 0; k <= GAUSS_JACKSON_ORDER; k++)
+	{
+		g.S -= gj_correct_pos[k] * g.a[k];
+	}
+	g.ready = true;
+}
+
+// DOP853 steps per Gauss-Jackson step while starting, to keep the start
+// well below the multistep's own error
+#define GAUSS_JACKSON_START_SUBSTEPS 2
+
+void Propagator::gauss_jackson_start(double h)
+{
+	GaussJacksonTable& g = gauss_jackson_table;
+	g.h = h;
+	g.t0 = t;
+	g.n = GAUSS_JACKSON_ORDER;
+
+	State y;
+	y << orbiter_elems.pos, orbiter_elems.vel;
+	g.a[GAUSS_JACKSON_ORDER] = acceleration(orbiter_elems.pos, t);
+	double hs = h / GAUSS_JACKSON_START_SUBSTEPS;
+	State k[12];
+	for(int i = 1; i <= GAUSS_JACKSON_ORDER * GAUSS_JACKSON_START_SUBSTEPS; i++)
+	{
+		double ts = t + (double)(i - 1) * hs;
+		k[0] = deriv(y, ts);
+		for(int s = 1; s < 12; s++)
+		{
+			State dy = State::Zero();
+			for(int j = 0; j < s; j++)
+			{
+				dy += dop853_a[s][j] * k[j];
+			}
+			k[s] = deriv(y + hs * dy, ts + dop853_c[s] * hs);
+		}
+		State dy = State::Zero();
+		for(int j = 0; j < 12; j++)
+		{
+			dy += dop853_a[12][j] * k[j];
+		}
+		y += hs * dy;
+
+		if(i % GAUSS_JACKSON_START_SUBSTEPS == 0)
+		{
+			g.a[GAUSS_JACKSON_ORDER - i / GAUSS_JACKSON_START_SUBSTEPS] =
+				acceleration(y.head<3>(), t + (double)(i / GAUSS_JACKSON_START_SUBSTEPS) * h);
+		}
+	}
+
+	gauss_jackson_sums(y.head<3>(), y.tail<3>());
+}
+
+void Propagator::gauss_jackson_shrink(double h)
+{
+	// Back points at the new spacing, the newest one is kept
+	GaussJacksonTable& g = gauss_jackson_table;
+	double tn = g.t0 + (double)g.n * g.h;
+	Eigen::Vector3d x, v;
+	gauss_jackson_state(0.0, x, v);
+	Eigen::Vector3d a[GAUSS_JACKSON_ORDER + 1];
+	a[0] = g.a[0];
+	for(int k = 1; k <= GAUSS_JACKSON_ORDER; k++)
+	{
+		Eigen::Vector3d xk, vk;
+		gauss_jackson_state(-(double)k * h / g.h, xk, vk);
+		a[k] = acceleration(xk, tn - (double)k * h);
 	}
 
+	std::copy(a, a + GAUSS_JACKSON_ORDER + 1, g.a);
+	g.h = h;
+	g.t0 = tn;
+	g.n = 0;
+	gauss_jackson_sums(x, v);
+}
+
+void Propagator::gauss_jackson_step()
+{
+	GaussJacksonTable& g = gauss_jackson_table;
+	double h2 = g.h * g.h;
+
+	Eigen::Vector3d x = g.S;
+	for(int k = 0; k <= GAUSS_JACKSON_ORDER; k++)
+	{
+		x += gj_predict_pos[k] * g.a[k];
+	}
+	x *= h2;
 
+	for(int k = GAUSS_JACKSON_ORDER; k > 0; k--)
+	{
+		g.a[k] = g.a[k - 1];
+	}
+	double t1 = g.t0 + (double)(g.n + 1) * g.h;
+	for(int i = 0; i <= gauss_jackson_corrections; i++)
+	{
+		g.a[0] = acceleration(x, t1);
+		if(i == gauss_jackson_corrections)
+		{
+			break;
+		}
+		x = g.S;
+		for(int k = 0; k <= GAUSS_JACKSON_ORDER; k++)
+		{
+			x += gj_correct_pos[k] * g.a[k];
+		}
+		x *= h2;
+	}
+
+	// The corrected state needs no storing, the sums and the last
+	// acceleration give it back
+	g.s += g.a[0];
+	g.S += g.s;
+	g.n++;
+}
+
+void Propagator::gauss_jackson_state(double x, Eigen::Vector3d& pos, Eigen::Vector3d& vel) const
+{
+	const GaussJacksonTable& g = gauss_jackson_table;
+
+	// d[m] ends up as the m-th backward difference at the newest point
+	Eigen::Vector3d d[GAUSS_JACKSON_ORDER + 1];
+	std::copy(g.a, g.a + GAUSS_JACKSON_ORDER + 1, d);
+	for(int m = 1; m <= GAUSS_JACKSON_ORDER; m++)
+	{
+		for(int i = GAUSS_JACKSON_ORDER; i >= m; i--)
+		{
+			d[i] = d[i - 1] - d[i];
+		}
+	}
+
+	// Series of (1 - t)^-x times G and H
+	double b[GAUSS_JACKSON_ORDER + 3];
+	b[0] = 1.0;
+	for(int j = 1; j < GAUSS_JACKSON_ORDER + 3; j++)
+	{
+		b[j] = b[j - 1] * (x + (double)(j - 1)) / (double)j;
+	}
+	double r[GAUSS_JACKSON_ORDER + 3];
+	double u[GAUSS_JACKSON_ORDER + 2];
+	for(int j = 0; j < GAUSS_JACKSON_ORDER + 3; j++)
+	{
+		r[j] = 0.0;
+		for(int i = 0; i <= j; i++)
+		{
+			r[j] += b[i] * gj_g[j - i];
+		}
+		if(j < GAUSS_JACKSON_ORDER + 2)
+		{
+			u[j] = 0.0;
+			for(int i = 0; i <= j; i++)
+			{
+				u[j] += b[i] * gj_h[j - i];
+			}
+		}
+	}
+
+	pos = r[0] * g.S + r[1] * g.s;
+	vel = u[0] * g.s;
+	for(int m = 0; m <= GAUSS_JACKSON_ORDER; m++)
+	{
+		pos += r[m + 2] * d[m];
+		vel += u[m + 1] * d[m];
+	}
+	pos *= g.h * g.h;
+	vel *= g.h;
+}
+
+template<bool use_vel, bool use_time>
+void Propagator::gauss_jackson(std::vector<EulerElements<use_vel, use_time>>& out, double tfor, double tstep, double sstep)
+{
+	GaussJacksonTable& g = gauss_jackson_table;
+	double t_start = t;
+	double t_end = t + tfor;
+	// Samples are taken at t_start + i * sstep, before t_end
+	size_t next_sample = 0;
+
+	// The table runs up to a step ahead of t. A shorter step is taken from it
+	// while its span still reaches back to t, anything else starts over.
+	if(g.ready && tstep != g.h)
+	{
+		double tn = g.t0 + (double)g.n * g.h;
+		if(tstep < g.h && tn - GAUSS_JACKSON_ORDER * tstep <= t)
+		{
+			gauss_jackson_shrink(tstep);
+		}
+		else
+		{
+			g.ready = false;
+		}
+	}
+	if(!g.ready)
+	{
+		gauss_jackson_start(tstep);
+	}
+
+	double tn = g.t0 + (double)g.n * g.h;
+	while(true)
+	{
+		// Samples before the newest point (or t_end) are interpolated
+		double t1 = std::min(tn, t_end);
+		for(double ts = t_start + (double)next_sample * sstep; ts < t1;
+			ts = t_start + (double)++next_sample * sstep)
+		{
+			Eigen::Vector3d ps, vs;
+			gauss_jackson_state((ts - tn) / g.h, ps, vs);
+			out.push_back(make_sample<use_vel, use_time>(ps, vs, ts));
+		}
+		if(tn >= t_end)
+		{
+			break;
+		}
+		gauss_jackson_step();
+		tn = g.t0 + (double)g.n * g.h;
+	}
+
+	gauss_jackson_state((t_end - tn) / g.h, orbiter_elems.pos, orbiter_elems.vel);
+	t = t_end;
+}
+
+// Shampine & Gordon (1975), STEP and INTRP: the Adams formulas in modified
+// divided differences, with error estimates at orders k - 2 to k + 1 picking
+// the order and the step. adams_gstr are the constant step error constants.
+static const double adams_gstr[ADAMS_MAX_ORDER + 1] = {
+	0.5, 0.0833, 0.0417, 0.0264, 0.0188, 0.0143, 0.0114, 0.00936, 0.00789, 0.00679, 0.00592, 0.00524, 0.00468
+};
+
+void Propagator::adams_start(double h)
+{
+	AdamsTable& a = adams_table;
+	a.t0 = t;
+	a.x = 0.0;
+	a.y << orbiter_elems.pos, orbiter_elems.vel;
+	a.yp = deriv(a.y, t);
+	a.phi[0] = a.yp;
+	a.phi[1].setZero();
+	a.round.setZero();
+	a.round_p.setZero();
+
+	// Small enough for the first order 1 step
+	double sum = 0.0;
+	for(int i = 0; i < 6; i++)
+	{
+		double wt = abs_tol + rel_tol * std::abs(a.y(i));
+		sum += (a.yp(i) / wt) * (a.yp(i) / wt);
+	}
+	sum = std::sqrt(sum / 6.0);
+	a.h = h;
+	if(1.0 < 16.0 * sum * h * h)
+	{
+		a.h = 0.25 * std::sqrt(1.0 / sum);
+	}
+
+	a.hold = 0.0;
+	a.k = 1;
+	a.kold = 0;
+	a.ns = 0;
+	a.phase1 = true;
+	a.sig[0] = 1.0;
+	a.ready = true;
+}
+
+void Propagator::adams_coefficients()
+{
+	AdamsTable& a = adams_table;
+	int k = a.k;
+	if(a.h != a.hold)
+	{
+		a.ns = 0;
+	}
+	if(a.ns <= a.kold)
+	{
+		a.ns++;
+	}
+	int ns = a.ns;
+	// Orders up to ns keep their constant step coefficients
+	if(k < ns)
+	{
+		return;
+	}
+
+	a.beta[ns - 1] = 1.0;
+	a.alpha[ns - 1] = 1.0 / (double)ns;
+	double temp1 = a.h * (double)ns;
+	a.sig[ns] = 1.0;
+	for(int i = ns + 1; i <= k; i++)
+	{
+		double temp2 = a.psi[i - 2];
+		a.psi[i - 2] = temp1;
+		a.beta[i - 1] = a.beta[i - 2] * a.psi[i - 2] / temp2;
+		temp1 = temp2 + a.h;
+		a.alpha[i - 1] = a.h / temp1;
+		a.sig[i] = (double)i * a.alpha[i - 1] * a.sig[i - 1];
+	}
+	a.psi[k - 1] = temp1;
+
+	// g(i, q) = g(i - 1, q) - alpha(i - 1) g(i - 1, q + 1) from g(1, q) = 1 / q,
+	// g(i) being g(i, 1). Redone whole instead of STEP's incremental update,
+	// it's a few dozen operations.
+	double w[ADAMS_MAX_ORDER + 1] = {};
+	for(int q = 1; q <= k + 1; q++)
+	{
+		w[q - 1] = 1.0 / (double)q;
+	}
+	a.g[0] = w[0];
+	for(int i = 2; i <= k + 1; i++)
+	{
+		for(int q = 1; q <= k + 2 - i; q++)
+		{
+			w[q - 1] -= a.alpha[i - 2] * w[q];
+		}
+		a.g[i - 1] = w[0];
+	}
+}
+
+void Propagator::adams_step()
+{
+	AdamsTable& a = adams_table;
+	State wt;
+	for(int i = 0; i < 6; i++)
+	{
+		wt(i) = abs_tol + rel_tol * std::abs(a.y(i));
+	}
+	// Weighted error norms are kept below 1, and below 0.5 for the next step
+	const double p5eps = 0.5;
+
+	int ifail = 0;
+	while(true)
+	{
+		// Steps below the resolution of x would not move it
+		a.h = std::max(a.h, 4.0 * std::numeric_limits<double>::epsilon() * std::abs(a.x));
+		adams_coefficients();
+		int k = a.k;
+
+		// Predict, turning the differences into the constant step ones
+		for(int i = a.ns + 1; i <= k; i++)
+		{
+			a.phi[i - 1] *= a.beta[i - 1];
+		}
+		a.phi[k + 1] = a.phi[k];
+		a.phi[k].setZero();
+		State p = State::Zero();
+		for(int i = k; i >= 1; i--)
+		{
+			p += a.g[i - 1] * a.phi[i - 1];
+			a.phi[i - 1] += a.phi[i];
+		}
+		State tau = a.h * p - a.round;
+		p = a.y + tau;
+		a.round_p = (p - a.y) - tau;
+
+		double xold = a.x;
+		a.x += a.h;
+		a.yp = deriv(p, a.t0 + a.x);
+
+		// Errors at orders k - 2, k - 1 and k as if the step were constant
+		double erkm2 = 0.0;
+		double erkm1 = 0.0;
+		double erk = 0.0;
+		for(int i = 0; i < 6; i++)
+		{
+			double d = a.yp(i) - a.phi[0](i);
+			if(k > 2)
+			{
+				erkm2 += ((a.phi[k - 2](i) + d) / wt(i)) * ((a.phi[k - 2](i) + d) / wt(i));
+			}
+			if(k > 1)
+			{
+				erkm1 += ((a.phi[k - 1](i) + d) / wt(i)) * ((a.phi[k - 1](i) + d) / wt(i));
+			}
+			erk += (d / wt(i)) * (d / wt(i));
+		}
+		double absh = std::abs(a.h);
+		if(k > 2)
+		{
+			erkm2 = absh * a.sig[k - 2] * adams_gstr[k - 3] * std::sqrt(erkm2 / 6.0);
+		}
+		if(k > 1)
+		{
+			erkm1 = absh * a.sig[k - 1] * adams_gstr[k - 2] * std::sqrt(erkm1 / 6.0);
+		}
+		double temp5 = absh * std::sqrt(erk / 6.0);
+		double err = temp5 * (a.g[k - 1] - a.g[k]);
+		erk = temp5 * a.sig[k] * adams_gstr[k - 1];
+
+		int knew = k;
+		if(k > 2 && std::max(erkm1, erkm2) <= erk)
+		{
+			knew = k - 1;
+		}
+		if(k == 2 && erkm1 <= 0.5 * erk)
+		{
+			knew = k - 1;
+		}
+
+		if(!(err <= 1.0))
+		{
+			// Undo the prediction, halve the step and drop to order 1 on the
+			// third failure, past it take the step the estimate asks for (NaN
+			// errors included, those keep halving)
+			a.phase1 = false;
+			a.x = xold;
+			for(int i = 1; i <= k; i++)
+			{
+				a.phi[i - 1] = (a.phi[i - 1] - a.phi[i]) / a.beta[i - 1];
+			}
+			for(int i = 2; i <= k; i++)
+			{
+				a.psi[i - 2] = a.psi[i - 1] - a.h;
+			}
+			ifail++;
+			double temp2 = 0.5;
+			if(ifail > 3 && p5eps < 0.25 * erk)
+			{
+				temp2 = std::sqrt(p5eps / erk);
+			}
+			if(ifail >= 3)
+			{
+				knew = 1;
+			}
+			a.h *= temp2;
+			a.k = knew;
+			a.ns = 0;
+			continue;
+		}
+
+		// Correct, evaluate and update the differences
+		a.kold = k;
+		a.hold = a.h;
+		State rho = a.h * a.g[k] * (a.yp - a.phi[0]) - a.round_p;
+		a.y = p + rho;
+		a.round = (a.y - p) - rho;
+		a.yp = deriv(a.y, a.t0 + a.x);
+
+		a.phi[k] = a.yp - a.phi[0];
+		a.phi[k + 1] = a.phi[k] - a.phi[k + 1];
+		for(int i = 1; i <= k; i++)
+		{
+			a.phi[i - 1] += a.phi[k];
+		}
+
+		// Order k + 1 is only estimated once the step has stayed the same
+		// long enough, and raised on every step while starting
+		if(knew == k - 1 || k == ADAMS_MAX_ORDER)
+		{
+			a.phase1 = false;
+		}
+		bool raise = a.phase1;
+		bool lower = !a.phase1 && knew == k - 1;
+		double erkp1 = 0.0;
+		if(!a.phase1 && !lower && k + 1 <= a.ns)
+		{
+			for(int i = 0; i < 6; i++)
+			{
+				erkp1 += (a.phi[k + 1](i) / wt(i)) * (a.phi[k + 1](i) / wt(i));
+			}
+			erkp1 = absh * adams_gstr[k] * std::sqrt(erkp1 / 6.0);
+			if(k == 1)
+			{
+				raise = erkp1 < 0.5 * erk;
+			}
+			else if(erkm1 <= std::min(erk, erkp1))
+			{
+				lower = true;
+			}
+			else
+			{
+				raise = erkp1 < erk && k != ADAMS_MAX_ORDER;
+			}
+		}
+		if(raise)
+		{
+			a.k = k + 1;
+			erk = erkp1;
+		}
+		else if(lower)
+		{
+			a.k = k - 1;
+			erk = erkm1;
+		}
+
+		// Double the step if the new order allows it, keep it, or shrink it
+		double hnew = 2.0 * a.h;
+		if(!a.phase1 && p5eps < erk * std::ldexp(1.0, a.k + 1))
+		{
+			hnew = a.h;
+			if(p5eps < erk)
+			{
+				double r = std::pow(p5eps / erk, 1.0 / (double)(a.k + 1));
+				hnew = absh * std::max(0.5, std::min(0.9, r));
+			}
+		}
+		a.h = hnew;
+		return;
+	}
+}
+
+void Propagator::adams_state(double tout, State& yout) const
+{
+	const AdamsTable& a = adams_table;
+	double hi = (tout - a.t0) - a.x;
+	int ki = a.kold + 1;
+
+	double w[ADAMS_MAX_ORDER + 1];
+	double g[ADAMS_MAX_ORDER + 1];
+	for(int i = 1; i <= ki; i++)
+	{
+		w[i - 1] = 1.0 / (double)i;
+	}
+	g[0] = 1.0;
+	double term = 0.0;
+	for(int j = 2; j <= ki; j++)
+	{
+		double psijm1 = a.psi[j - 2];
+		double gamma = (hi + term) / psijm1;
+		double eta = hi / psijm1;
+		for(int i = 1; i <= ki + 1 - j; i++)
+		{
+			w[i - 1] = gamma * w[i - 1] - eta * w[i];
+		}
+		g[j - 1] = w[0];
+		term = psijm1;
+	}
+
+	yout.setZero();
+	for(int i = ki; i >= 1; i--)
+	{
+		yout += g[i - 1] * a.phi[i - 1];
+	}
+	yout = a.y + hi * yout;
+}
+
+template<bool use_vel, bool use_time>
+void Propagator::adams(std::vector<EulerElements<use_vel, use_time>>& out, double tfor, double tstep, double sstep)
+{
+	AdamsTable& a = adams_table;
+	double t_start = t;
+	double t_end = t + tfor;
+	// Samples are taken at t_start + i * sstep, before t_end
+	size_t next_sample = 0;
+
+	if(!a.ready)
+	{
+		adams_start(tstep);
+	}
+
+	State ys;
+	while(true)
+	{
+		// Samples before the solution point (or t_end) are interpolated
+		double t1 = std::min(a.t0 + a.x, t_end);
+		for(double ts = t_start + (double)next_sample * sstep; ts < t1;
+			ts = t_start + (double)++next_sample * sstep)
+		{
+			adams_state(ts, ys);
+			out.push_back(make_sample<use_vel, use_time>(ys.head<3>(), ys.tail<3>(), ts));
+		}
+		if(a.x >= t_end - a.t0)
+		{
+			break;
+		}
+		adams_step();
+	}
+
+	adams_state(t_end, ys);
+	orbiter_elems.pos = ys.head<3>();
+	orbiter_elems.vel = ys.tail<3>();
+	t = t_end;
+}
+
+// Bulirsch-Stoer order and step control (Hairer, Norsett & Wanner II.9, as
+// in Numerical Recipes' StepperBS): step factors are limited to
+// [BS_FACMIN^(1/(2k+1)) / BS_MAX_GROW, BS_FACMIN^-(1/(2k+1))], and the order
+// moves to wherever the work per unit step is lowest
+#define BS_SAFETY1 0.65
+#define BS_SAFETY2 0.94
+#define BS_FACMIN 0.02
+#define BS_MAX_GROW 4.0
+#define BS_ORDER_DOWN 0.8
+#define BS_ORDER_UP 0.9
+
+// Substeps of the k-th midpoint sequence
+static int bs_substeps(int k)
+{
+	return 2 * (k + 1);
+}
+
+Propagator::State Propagator::midpoint(const State& y, const State& dydx, double t, double h, int n)
+{
+	double hs = h / (double)n;
+	State ym = y;
+	State yn = y + hs * dydx;
+	State yd = deriv(yn, t + hs);
+	for(int i = 1; i < n; i++)
+	{
+		State swap = ym + 2.0 * hs * yd;
+		ym = yn;
+		yn = swap;
+		yd = deriv(yn, t + (double)(i + 1) * hs);
+	}
+	// Gragg's smoothing step
+	return 0.5 * (ym + yn + hs * yd);
+}
+
+double Propagator::bulirsch_stoer_step(State& y, State& dydx, double h, double& h_next)
+{
+	// Evaluations for the sequences up to k, and the step each one asks for
+	double cost[BULIRSCH_STOER_COLUMNS + 1];
+	double hopt[BULIRSCH_STOER_COLUMNS + 1];
+	double work[BULIRSCH_STOER_COLUMNS + 1];
+	cost[0] = bs_substeps(0) + 1;
+	for(int k = 1; k <= BULIRSCH_STOER_COLUMNS; k++)
+	{
+		cost[k] = cost[k - 1] + bs_substeps(k);
+	}
+	work[0] = 0.0;
+
+	State y0 = y;
+	State y1 = y;
+	int k = 0;
+	bool reject = true;
+	while(reject)
+	{
+		reject = false;
+		for(k = 0; k <= bs_order + 1; k++)
+		{
+			State yk = midpoint(y0, dydx, t, h, bs_substeps(k));
+			if(k == 0)
+			{
+				y1 = yk;
+				continue;
+			}
+
+			// Aitken-Neville in h^2 up the tableau, y1 ends up as the
+			// extrapolation of all k + 1 sequences and column 0 as the one of
+			// the last k
+			bs_table.col(k - 1) = yk;
+			for(int j = k - 1; j > 0; j--)
+			{
+				double ratio = (double)bs_substeps(k) / (double)bs_substeps(j);
+				bs_table.col(j - 1) = bs_table.col(j) + (bs_table.col(j) - bs_table.col(j - 1)) / (ratio * ratio - 1.0);
+			}
+			double ratio = (double)bs_substeps(k) / (double)bs_substeps(0);
+			y1 = bs_table.col(0) + (bs_table.col(0) - y1) / (ratio * ratio - 1.0);
+
+			double err = 0.0;
+			for(int i = 0; i < 6; i++)
+			{
+				double sk = abs_tol + rel_tol * std::max(std::abs(y0(i)), std::abs(y1(i)));
+				double e = (y1(i) - bs_table(i, 0)) / sk;
+				err += e * e;
+			}
+			err = std::sqrt(err / 6.0);
+
+			double expo = 1.0 / (double)(2 * k + 1);
+			double facmin = std::pow(BS_FACMIN, expo);
+			double fac = 1.0 / facmin;
+			if(std::isnan(err))
+			{
+				fac = facmin / BS_MAX_GROW;
+			}
+			else if(err > 0.0)
+			{
+				fac = BS_SAFETY2 / std::pow(err / BS_SAFETY1, expo);
+				fac = std::max(facmin / BS_MAX_GROW, std::min(1.0 / facmin, fac));
+			}
+			hopt[k] = h * fac;
+			work[k] = cost[k] / hopt[k];
+
+			// Convergence is expected around the target column, and given up
+			// early if the error is too far off to get there
+			if(bs_first && err <= 1.0)
+			{
+				break;
+			}
+			if(k == bs_order - 1 && !bs_rejected && !bs_first)
+			{
+				double n = (double)bs_substeps(bs_order) * bs_substeps(bs_order + 1) /
+						   (bs_substeps(0) * bs_substeps(0));
+				if(err <= 1.0)
+				{
+					break;
+				}
+				else if(err > n * n)
+				{
+					reject = true;
+					bs_order = k;
+					if(bs_order > 1 && work[k - 1] < BS_ORDER_DOWN * work[k])
+					{
+						bs_order--;
+					}
+					h = hopt[bs_order];
+					break;
+				}
+			}
+			if(k == bs_order)
+			{
+				double n = (double)bs_substeps(k + 1) / bs_substeps(0);
+				if(err <= 1.0)
+				{
+					break;
+				}
+				else if(err > n * n)
+				{
+					reject = true;
+					if(bs_order > 1 && work[k - 1] < BS_ORDER_DOWN * work[k])
+					{
+						bs_order--;
+					}
+					h = hopt[bs_order];
+					break;
+				}
+			}
+			if(k == bs_order + 1)
+			{
+				if(!(err <= 1.0))
+				{
+					reject = true;
+					if(bs_order > 1 && work[bs_order - 1] < BS_ORDER_DOWN * work[bs_order])
+					{
+						bs_order--;
+					}
+					h = hopt[bs_order];
+				}
+				break;
+			}
+		}
+		if(reject)
+		{
+			bs_rejected = true;
+		}
+	}
+
+	y = y1;
+	dydx = deriv(y, t + h);
+	bs_first = false;
+
+	// Order with the least work per unit step for the next one
+	int kopt;
+	if(k == 1)
+	{
+		kopt = 2;
+	}
+	else if(k <= bs_order)
+	{
+		kopt = k;
+		if(work[k - 1] < BS_ORDER_DOWN * work[k])
+		{
+			kopt = k - 1;
+		}
+		else if(work[k] < BS_ORDER_UP * work[k - 1])
+		{
+			kopt = std::min(k + 1, BULIRSCH_STOER_COLUMNS - 1);
+		}
+	}
+	else
+	{
+		kopt = k - 1;
+		if(k > 2 && work[k - 2] < BS_ORDER_DOWN * work[k - 1])
+		{
+			kopt = k - 2;
+		}
+		if(work[k] < BS_ORDER_UP * work[kopt])
+		{
+			kopt = std::min(k, BULIRSCH_STOER_COLUMNS - 1);
+		}
+	}
+
+	if(bs_rejected)
+	{
+		bs_order = std::min(kopt, k);
+		h_next = std::min(h, hopt[bs_order]);
+		bs_rejected = false;
+	}
+	else
+	{
+		if(kopt <= k)
+		{
+			h_next = hopt[kopt];
+		}
+		else if(k < bs_order && work[k] < BS_ORDER_UP * work[k - 1])
+		{
+			h_next = hopt[k] * cost[kopt + 1] / cost[k];
+		}
+		else
+		{
+			h_next = hopt[k] * cost[kopt] / cost[k];
+		}
+		bs_order = kopt;
+	}
+	return h;
+}
+
+template<bool use_vel, bool use_time>
+void Propagator::bulirsch_stoer(std::vector<EulerElements<use_vel, use_time>>& out, double tfor, double tstep, double sstep)
+{
+	double t_start = t;
+	double t_end = t + tfor;
+	// Samples are taken at t_start + i * sstep, before t_end
+	size_t next_sample = 0;
+
+	if(adaptive_step <= 0.0)
+	{
+		// Higher orders for tighter tolerances to start with
+		double order = -std::log10(std::max(1e-12, rel_tol)) * 0.6 + 0.5;
+		bs_order = std::max(1, std::min(BULIRSCH_STOER_COLUMNS - 1, (int)order));
+		bs_first = true;
+		bs_rejected = false;
+	}
+	double h = adaptive_step > 0.0 ? adaptive_step : tstep;
+	State y;
+	y << orbiter_elems.pos, orbiter_elems.vel;
+	State dydx = deriv(y, t);
+
+	while(true)
+	{
+		for(double ts = t_start + (double)next_sample * sstep; ts <= t && ts < t_end;
+			ts = t_start + (double)++next_sample * sstep)
+		{
+			out.push_back(make_sample<use_vel, use_time>(y.head<3>(), y.tail<3>(), ts));
+		}
+		if(t >= t_end)
+		{
+			break;
+		}
+
+		// Steps are cut to end on the next sample (or t_end), the proposal
+		// is kept for the one after
+		double t1 = std::min(t_start + (double)next_sample * sstep, t_end);
+		bool clipped = t + h >= t1;
+		double h_full = h;
+		if(clipped)
+		{
+			h = t1 - t;
+		}
+
+		double h_next;
+		double h_done = bulirsch_stoer_step(y, dydx, h, h_next);
+		t = clipped && h_done == h ? t1 : t + h_done;
+		h = clipped && h_done == h ? std::max(h_full, h_next) : h_next;
+	}
+
+	adaptive_step = h;
+	orbiter_elems.pos = y.head<3>();
+	orbiter_elems.vel = y.tail<3>();
+}
+
+// Coefficient k of w = s^alpha from the lower ones (s w' = alpha s' w)
+static double series_pow(const double* s, const double* w, double alpha, int k)
+{
+	if(k == 0)
+	{
+		return std::pow(s[0], alpha);
+	}
+	double sum = 0.0;
+	for(int j = 0; j < k; j++)
+	{
+		sum += (alpha * (double)(k - j) - (double)j) * s[k - j] * w[j];
+	}
+	return sum / ((double)k * s[0]);
+}
+
+double Propagator::taylor_expand(int n)
+{
+	TaylorSeries& ts = taylor_series;
+	ts.x[0] = orbiter_elems.pos;
+	ts.x[1] = orbiter_elems.vel;
+
+	// Third bodies, their series only depend on time
+	double valid = std::numeric_limits<double>::infinity();
+	double mu[2 + PLANET_COUNT];
+	int bodies = 0;
+	if(use_ephemerides)
+	{
+		valid = ephemeris_cache.sun_moon_series(t, n, ts.body[0], ts.body[1]);
+		mu[0] = MU_SUN;
+		mu[1] = MU_MOON;
+		bodies = 2;
+		for(int p = 0; p < PLANET_COUNT; p++)
+		{
+			if(planets_active[p])
+			{
+				valid = std::min(valid, planet_ephemeris.position_series((Planet)p, t, n, ts.body[bodies]));
+				mu[bodies++] = planet_mu((Planet)p);
+			}
+		}
+
+		for(int k = 0; k + 2 <= n; k++)
+		{
+			ts.indirect[k].setZero();
+		}
+		for(int i = 0; i < bodies; i++)
+		{
+			// rel_s and rel_w hold |body|^2 and its -3/2 power for now
+			for(int k = 0; k + 2 <= n; k++)
+			{
+				ts.rel_s[i][k] = 0.0;
+				for(int j = 0; j <= k; j++)
+				{
+					ts.rel_s[i][k] += ts.body[i][j].dot(ts.body[i][k - j]);
+				}
+				ts.rel_w[i][k] = series_pow(ts.rel_s[i], ts.rel_w[i], -1.5, k);
+				for(int j = 0; j <= k; j++)
+				{
+					ts.indirect[k] -= mu[i] * ts.rel_w[i][k - j] * ts.body[i][j];
+				}
+			}
+		}
+	}
+
+	// The acceleration up to order k gives the position up to k + 2. Central
+	// gravity and J2 are folded into x c1, y c1, z c2, with
+	//   c1 = -MU s^-3/2 + J2 (7.5 z^2 - 1.5 s) s^-7/2
+	//   c2 = -MU s^-3/2 + J2 (7.5 z^2 - 4.5 s) s^-7/2
+	// which is f() with x^2 + y^2 = s - z^2
+	for(int k = 0; k + 2 <= n; k++)
+	{
+		ts.s[k] = 0.0;
+		for(int j = 0; j <= k; j++)
+		{
+			ts.s[k] += ts.x[j].dot(ts.x[k - j]);
+		}
+		ts.w[k] = series_pow(ts.s, ts.w, -1.5, k);
+		ts.c1[k] = -MU * ts.w[k];
+		ts.c2[k] = ts.c1[k];
+
+		if(use_geopotential)
+		{
+			ts.z2[k] = 0.0;
+			for(int j = 0; j <= k; j++)
+			{
+				ts.z2[k] += ts.x[j](2) * ts.x[k - j](2);
+			}
+			ts.q1[k] = 7.5 * ts.z2[k] - 1.5 * ts.s[k];
+			ts.q2[k] = 7.5 * ts.z2[k] - 4.5 * ts.s[k];
+			ts.w7[k] = series_pow(ts.s, ts.w7, -3.5, k);
+			double j1 = 0.0;
+			double j2 = 0.0;
+			for(int j = 0; j <= k; j++)
+			{
+				j1 += ts.q1[j] * ts.w7[k - j];
+				j2 += ts.q2[j] * ts.w7[k - j];
+			}
+			ts.c1[k] += J2 * j1;
+			ts.c2[k] += J2 * j2;
+		}
+
+		Eigen::Vector3d acc = Eigen::Vector3d::Zero();
+		for(int j = 0; j <= k; j++)
+		{
+			acc(0) += ts.x[j](0) * ts.c1[k - j];
+			acc(1) += ts.x[j](1) * ts.c1[k - j];
+			acc(2) += ts.x[j](2) * ts.c2[k - j];
+		}
+
+		if(use_ephemerides)
+		{
+			for(int i = 0; i < bodies; i++)
+			{
+				ts.rel[i][k] = ts.body[i][k] - ts.x[k];
+				ts.rel_s[i][k] = 0.0;
+				for(int j = 0; j <= k; j++)
+				{
+					ts.rel_s[i][k] += ts.rel[i][j].dot(ts.rel[i][k - j]);
+				}
+				ts.rel_w[i][k] = series_pow(ts.rel_s[i], ts.rel_w[i], -1.5, k);
+				for(int j = 0; j <= k; j++)
+				{
+					acc += mu[i] * ts.rel_w[i][k - j] * ts.rel[i][j];
+				}
+			}
+			acc += ts.indirect[k];
+		}
+
+		ts.x[k + 2] = acc / ((double)(k + 1) * (double)(k + 2));
+	}
+
+	return valid;
+}
+
+template<bool use_vel, bool use_time>
+void Propagator::taylor(std::vector<EulerElements<use_vel, use_time>>& out, double tfor, double /*tstep*/, double sstep)
+{
+	TaylorSeries& ts = taylor_series;
+	double t_start = t;
+	double t_end = t + tfor;
+	// Samples are taken at t_start + i * sstep, before t_end
+	size_t next_sample = 0;
+	int n = std::max(2, std::min(TAYLOR_MAX_ORDER, taylor_order));
+
+	auto eval = [&ts, n](double dt, Eigen::Vector3d& pos, Eigen::Vector3d& vel)
+	{
+		pos = ts.x[n];
+		vel = (double)n * ts.x[n];
+		for(int k = n - 1; k >= 0; k--)
+		{
+			pos = pos * dt + ts.x[k];
+			if(k > 0)
+			{
+				vel = vel * dt + (double)k * ts.x[k];
+			}
+		}
+	};
+
+	while(t < t_end)
+	{
+		double valid = taylor_expand(n);
+		force_evaluations += TAYLOR_EXPANSION_COST(n);
+
+		// Jorba & Zou: the last two terms are kept at the tolerance
+		double eps = abs_tol + rel_tol * orbiter_elems.pos.norm();
+		double h = std::numeric_limits<double>::infinity();
+		for(int k = n - 1; k <= n; k++)
+		{
+			double c = ts.x[k].lpNorm<Eigen::Infinity>();
+			if(c > 0.0)
+			{
+				h = std::min(h, std::pow(eps / c, 1.0 / (double)k));
+			}
+		}
+
+		double t1 = std::min(std::min(t + h, valid), t_end);
+		for(double s = t_start + (double)next_sample * sstep; s < t1;
+			s = t_start + (double)++next_sample * sstep)
+		{
+			Eigen::Vector3d ps, vs;
+			eval(s - t, ps, vs);
+			out.push_back(make_sample<use_vel, use_time>(ps, vs, s));
+		}
+
+		eval(t1 - t, orbiter_elems.pos, orbiter_elems.vel);
+		t = t1;
+	}
+}
+
+template<bool use_vel, bool use_time>
+std::vector<EulerElements<use_vel, use_time>> Propagator::propagate(double tfor, double tstep, double sstep)
+{
+	std::vector<EulerElements<use_vel, use_time>> out;
+	out.reserve((size_t)std::ceil(tfor / sstep));
+
+	if(use_ephemerides)
+	{
+		apply_precision();
+	}
+	if(use_ephemerides && (ephemeris_source == EphemerisSource::Chebyshev || integrator == Integrator::Taylor))
+	{
+		if(ephemeris_cache.lunar_terms != lunar_terms)
+		{
+			ephemeris_cache.lunar_terms = lunar_terms;
+			ephemeris_cache.clear();
+		}
+		ephemeris_cache.prepare(t, ephemeris_reach(tfor, tstep));
+	}
+	// Off the grid every stepper lookup restarts it with a full evaluation
+	active_source = ephemeris_source;
+	if(ephemeris_source == EphemerisSource::Stepper && integrator != Integrator::RK4)
+	{
+		active_source = EphemerisSource::Direct;
+	}
+	if(use_ephemerides && active_source == EphemerisSource::Stepper)
+	{
+		// Stages are evaluated at t, t + h/2 and t + h
+		ephemeris_stepper.init(t, tstep * 0.5, lunar_terms);
+	}
+	gate_planets(tfor);
+	if(use_ephemerides && prefetch_ephemerides && integrator == Integrator::RK4)
+	{
+		start_prefetch(t, tstep, tfor);
+	}
+
+	switch(integrator)
+	{
+	case Integrator::RK4:
+		rk4(out, tfor, tstep, sstep);
+		break;
+	case Integrator::DormandPrince:
+		dormand_prince(out, tfor, tstep, sstep);
+		break;
+	case Integrator::DOP853:
+		dop853(out, tfor, tstep, sstep);
+		break;
+	case Integrator::RKN:
+		nystrom(out, tfor, tstep, sstep);
+		break;
+	case Integrator::GaussJackson:
+		gauss_jackson(out, tfor, tstep, sstep);
+		break;
+	case Integrator::Adams:
+		adams(out, tfor, tstep, sstep);
+		break;
+	case Integrator::BulirschStoer:
+		bulirsch_stoer(out, tfor, tstep, sstep);
+		break;
+	case Integrator::Taylor:
+		taylor(out, tfor, tstep, sstep);
+		break;
+	}
+	stop_prefetch();
 
 	return out;
 }
@@ -1,7 +1,83 @@
 #pragma once
 #include "Kepler.h"
 #include "Eigen/Dense"
-#include "vsop87a_large.h"
+#include "Ephemeris.h"
+#include "SpscRing.h"
+#include <array>
+#include <atomic>
+#include <thread>
+
+// Epochs the prefetch thread may run ahead of the integrator
+#define PREFETCH_DEPTH 256
+// Highest difference of the accelerations the Gauss-Jackson integrator uses
+#define GAUSS_JACKSON_ORDER 8
+// Highest order of the Adams integrator
+#define ADAMS_MAX_ORDER 12
+// Columns of the Bulirsch-Stoer extrapolation tableau
+#define BULIRSCH_STOER_COLUMNS 8
+// Highest order of the Taylor integrator
+#define TAYLOR_MAX_ORDER 30
+// f() calls an expansion of order n is counted as in get_force_evaluations.
+// Measured at 0.24-0.33 n^2 with Kepler and J2 only, 0.14-0.31 n^2 with the
+// Sun and Moon (more terms share the ephemeris lookup)
+#define TAYLOR_EXPANSION_COST(n) ((n) * (n) / 4)
+
+// Where f() reads the Sun and Moon positions from. Integrator::Taylor
+// ignores it and always differentiates the Chebyshev fit.
+enum class EphemerisSource
+{
+	// Full VSOP87 series at every evaluation
+	Direct,
+	// Piecewise Chebyshev fit (ChebyshevEphemeris)
+	Chebyshev,
+	// Phasor recurrence over the RK4 half-step grid (StepperEphemeris). RK4
+	// only, the other integrators step off the grid and use Direct instead.
+	Stepper
+};
+
+// How propagate advances the state
+enum class Integrator
+{
+	// Classic Runge-Kutta with fixed step tstep
+	RK4,
+	// Dormand-Prince RK5(4), adaptive with FSAL, samples taken from its dense
+	// output. tstep is only the first step tried.
+	DormandPrince,
+	// Hairer's DOP853, adaptive 8th order with 7th order dense output, for
+	// long arcs with steps of minutes
+	DOP853,
+	// Nystrom's 4 stage 5th order Runge-Kutta-Nystrom method, adaptive on an
+	// embedded 4th order position. Only evaluates accelerations (f() must not
+	// depend on the velocity), samples come from quintic Hermite interpolation.
+	RKN,
+	// 8th order Gauss-Jackson multistep with fixed step tstep: one force
+	// evaluation per step (plus gauss_jackson_corrections), started with
+	// DOP853 steps. Also only evaluates accelerations.
+	GaussJackson,
+	// Shampine & Gordon's variable order (1 to 12), variable step
+	// Adams-Bashforth-Moulton PECE, two evaluations per step. Samples are
+	// interpolated from its divided differences.
+	Adams,
+	// Gragg-Bulirsch-Stoer: modified midpoint rule with 2, 4, 6, ... substeps,
+	// extrapolated to zero step, adaptive in order and step. For very tight
+	// tolerances. Steps end exactly on the samples, so sstep caps the step.
+	BulirschStoer,
+	// Taylor series of order taylor_order, its coefficients found by automatic
+	// differentiation of the force model (no f() calls). The step comes from
+	// the decay of the last coefficients, samples from the series itself and
+	// tstep is unused. Third bodies always come from ephemeris_cache, whatever
+	// ephemeris_source says, so they are only as accurate as its tolerance.
+	Taylor
+};
+
+// How the VSOP87 series are summed
+enum class EphemerisPrecision
+{
+	Double,
+	// Terms below mixed_precision_au in float (see vsop87a_mixed),
+	// within 1.2e-12 AU (0.2 m) of Double for 1e-7 AU over a year around the start
+	Mixed
+};
 
 class Propagator
 {
@@ -14,22 +90,241 @@ private:
 	double st;
 
 	Eigen::Vector3d ephemeris_acc;
+	StepperEphemeris ephemeris_stepper;
+	PlanetEphemeris planet_ephemeris;
+	bool planets_active[PLANET_COUNT];
+	EphemerisPrecision ephemeris_precision;
+	// ephemeris_source as used by the current propagate call
+	EphemerisSource active_source;
+	// Start of the float phases in Mixed precision, in julian millennia
+	double mixed_t0;
+	vsop87a_mixed mixed_tables;
+	// Splits mixed_tables for ephemeris_precision and hands them to the fits
+	void apply_precision();
+
+	// Everything third-body related that only depends on time, for the last
+	// few epochs (RK4 evaluates t + h twice, and chunks start where the last
+	// one ended)
+	struct EphemerisMemo
+	{
+		double t;
+		Eigen::Vector3d sun;
+		Eigen::Vector3d moon;
+		// Relative to earth in meters, only for the active planets
+		Eigen::Vector3d planets[PLANET_COUNT];
+		// Acceleration of the Earth towards the bodies, with changed sign
+		Eigen::Vector3d indirect_acc;
+	};
+	std::array<EphemerisMemo, 4> memo;
+	size_t memo_next;
+	// vsop87a_large::getTableVersion() of the entries
+	int memo_version;
+	size_t memo_hits;
+	size_t memo_misses;
+
+	const EphemerisMemo& ephemeris_at(double t);
+	// Fills m for m.t from ephemeris_source
+	void eval_ephemeris(EphemerisMemo& m);
+	void clear_memo();
+	// Turns on the planets pulling hard enough over [t, t + tfor]
+	void gate_planets(double tfor);
+	// Latest time the integrator may evaluate the forces at in the coming
+	// propagate call, the multistep ones run past its end
+	double ephemeris_reach(double tfor, double tstep) const;
 
-	using vsop = vsop87a_large;
+	// Producer thread evaluating the stage epochs of the coming steps in the
+	// order ephemeris_at misses them
+	SpscRing<EphemerisMemo, PREFETCH_DEPTH> prefetch_ring;
+	std::thread prefetch_thread;
+	std::atomic<bool> prefetch_stop;
+	std::atomic<bool> prefetch_done;
+	bool prefetching;
+
+	void start_prefetch(double t0, double tstep, double tfor);
+	void stop_prefetch();
 
 	// Note, prime is derivatives! pos -> vel  and   vel -> acc
 	template<bool eval_time>
 	void f(EulerElements<true>& prime, const EulerElements<true>& eval, double t);
 	void set_b(EulerElements<true>& b, const EulerElements<true>& prime, const EulerElements<true>& b0, double h);
 
+	// Position and velocity stacked, for the adaptive integrators
+	typedef Eigen::Matrix<double, 6, 1> State;
+	State deriv(const State& y, double t);
+	Eigen::Vector3d acceleration(const Eigen::Vector3d& pos, double t);
+
+	// Step the adaptive integrators try next (carried over propagate calls,
+	// 0 to start from tstep) and error norm of the last accepted one
+	double adaptive_step;
+	double adaptive_err;
+
+	template<bool use_vel, bool use_time>
+	void rk4(std::vector<EulerElements<use_vel, use_time>>& out, double tfor, double tstep, double sstep);
+	template<bool use_vel, bool use_time>
+	void dormand_prince(std::vector<EulerElements<use_vel, use_time>>& out, double tfor, double tstep, double sstep);
+	template<bool use_vel, bool use_time>
+	void dop853(std::vector<EulerElements<use_vel, use_time>>& out, double tfor, double tstep, double sstep);
+	template<bool use_vel, bool use_time>
+	void nystrom(std::vector<EulerElements<use_vel, use_time>>& out, double tfor, double tstep, double sstep);
+
+	// Gauss-Jackson back points, kept over propagate calls while tstep stays
+	// the same. The state at the newest point is fully given by them.
+	struct GaussJacksonTable
+	{
+		bool ready;
+		double h;
+		// The newest point is at t0 + n * h
+		double t0;
+		long long n;
+		// First and second sums of the accelerations up to the newest point
+		Eigen::Vector3d s;
+		Eigen::Vector3d S;
+		// Accelerations at the newest point and the ones before it
+		Eigen::Vector3d a[GAUSS_JACKSON_ORDER + 1];
+	};
+	GaussJacksonTable gauss_jackson_table;
+
+	// Fills the table from orbiter_elems at t with fixed DOP853 steps
+	void gauss_jackson_start(double h);
+	// Refills the table for a shorter step from its own interpolation
+	void gauss_jackson_shrink(double h);
+	// Sets up the sums for the state x, v at the newest point
+	void gauss_jackson_sums(const Eigen::Vector3d& x, const Eigen::Vector3d& v);
+	void gauss_jackson_step();
+	// State at the newest point plus x steps (-GAUSS_JACKSON_ORDER to 0)
+	void gauss_jackson_state(double x, Eigen::Vector3d& pos, Eigen::Vector3d& vel) const;
+	template<bool use_vel, bool use_time>
+	void gauss_jackson(std::vector<EulerElements<use_vel, use_time>>& out, double tfor, double tstep, double sstep);
+
+	// Adams state (Shampine & Gordon's STEP), kept over propagate calls. It
+	// runs up to a step ahead of t, and is sized for the highest order so
+	// nothing is allocated once started.
+	struct AdamsTable
+	{
+		bool ready;
+		// Order of the next step and of the last one, and steps taken with h
+		// (counting the current one)
+		int k;
+		int kold;
+		int ns;
+		// Raising the order and doubling the step on every step while starting
+		bool phase1;
+		// Time since t0 of the solution point, kept apart from the epoch so
+		// that the first (tiny) steps don't round away
+		double t0;
+		double x;
+		double h;
+		double hold;
+		State y;
+		State yp;
+		// Modified divided differences of yp
+		State phi[ADAMS_MAX_ORDER + 2];
+		// Rounding errors of the compensated sums, for y and the prediction
+		State round;
+		State round_p;
+		double psi[ADAMS_MAX_ORDER];
+		double alpha[ADAMS_MAX_ORDER];
+		double beta[ADAMS_MAX_ORDER];
+		double sig[ADAMS_MAX_ORDER + 1];
+		double g[ADAMS_MAX_ORDER + 1];
+	};
+	AdamsTable adams_table;
+
+	void adams_start(double h);
+	// Coefficients of the formulas for the next step
+	void adams_coefficients();
+	void adams_step();
+	// Solution at tout, within the last step
+	void adams_state(double tout, State& yout) const;
+	template<bool use_vel, bool use_time>
+	void adams(std::vector<EulerElements<use_vel, use_time>>& out, double tfor, double tstep, double sstep);
+
+	// Bulirsch-Stoer extrapolation tableau (column k - 1 takes the k-th
+	// midpoint sequence and is extrapolated in place), the column convergence
+	// is aimed at, and whether the last attempt was rejected
+	Eigen::Matrix<double, 6, BULIRSCH_STOER_COLUMNS> bs_table;
+	int bs_order;
+	bool bs_first;
+	bool bs_rejected;
+
+	// Gragg's modified midpoint rule over h with n substeps from y at t,
+	// dydx being the derivative there
+	State midpoint(const State& y, const State& dydx, double t, double h, int n);
+	// One step from t of h or less, returning the length taken. y and dydx
+	// are advanced, h_next is the step proposed after it.
+	double bulirsch_stoer_step(State& y, State& dydx, double h, double& h_next);
+	template<bool use_vel, bool use_time>
+	void bulirsch_stoer(std::vector<EulerElements<use_vel, use_time>>& out, double tfor, double tstep, double sstep);
+
+	// Taylor coefficients of the position about the current t (x[k]
+	// multiplies (t' - t)^k) and of the pieces of the force model
+	struct TaylorSeries
+	{
+		Eigen::Vector3d x[TAYLOR_MAX_ORDER + 1];
+		// r.r, its -3/2 and -7/2 powers and z^2
+		double s[TAYLOR_MAX_ORDER + 1];
+		double w[TAYLOR_MAX_ORDER + 1];
+		double w7[TAYLOR_MAX_ORDER + 1];
+		double z2[TAYLOR_MAX_ORDER + 1];
+		// The J2 polynomials of x, y and of z (with z^2 + x^2 + y^2 = s)
+		double q1[TAYLOR_MAX_ORDER + 1];
+		double q2[TAYLOR_MAX_ORDER + 1];
+		// Central and J2 acceleration over x, y and over z
+		double c1[TAYLOR_MAX_ORDER + 1];
+		double c2[TAYLOR_MAX_ORDER + 1];
+		// Sun, Moon and planets: position, satellite to body, its squared
+		// norm and the -3/2 power of that
+		Eigen::Vector3d body[2 + PLANET_COUNT][TAYLOR_MAX_ORDER + 1];
+		Eigen::Vector3d rel[2 + PLANET_COUNT][TAYLOR_MAX_ORDER + 1];
+		double rel_s[2 + PLANET_COUNT][TAYLOR_MAX_ORDER + 1];
+		double rel_w[2 + PLANET_COUNT][TAYLOR_MAX_ORDER + 1];
+		// Acceleration of the Earth towards the bodies, with changed sign
+		Eigen::Vector3d indirect[TAYLOR_MAX_ORDER + 1];
+	};
+	TaylorSeries taylor_series;
+
+	// Fills taylor_series up to order n from orbiter_elems at t, returning
+	// the time up to which the third body series hold
+	double taylor_expand(int n);
+	template<bool use_vel, bool use_time>
+	void taylor(std::vector<EulerElements<use_vel, use_time>>& out, double tfor, double tstep, double sstep);
+
+	size_t force_evaluations;
+
 
 public:
 
 	bool use_geopotential;
 	bool use_ephemerides;
+	Integrator integrator;
+	// Adaptive integrators keep the local error of each component below
+	// abs_tol + rel_tol * |component| (meters and m/s)
+	double abs_tol;
+	double rel_tol;
+	// Extra evaluate-correct passes of each Gauss-Jackson step, 0 evaluates
+	// the accelerations at the predicted position only
+	int gauss_jackson_corrections;
+	// Order of the Taylor integrator, up to TAYLOR_MAX_ORDER
+	int taylor_order;
+	EphemerisSource ephemeris_source;
+	// Periodic terms of the lunar theory (see sun_moon_geocentric)
+	int lunar_terms;
+	// Venus, Mars, Jupiter and Saturn as third bodies (with use_ephemerides).
+	// A planet is skipped for a propagate call if its tidal acceleration at
+	// the apoapsis of the current orbit stays below planet_threshold (m/s^2).
+	bool use_planets;
+	double planet_threshold;
+	// Evaluates the ephemerides on a second thread, ahead of the integrator.
+	// Only worth it with a core to spare, and only used with RK4 (the
+	// adaptive integrators don't know their epochs in advance).
+	bool prefetch_ephemerides;
+
+	// Fit settings (and the cache file) can be changed before the first
+	// propagate call
+	ChebyshevEphemeris ephemeris_cache;
 
 	// tfor: How long to propagate for
-	// tstep: Timestep to use during propagation
+	// tstep: Timestep to use during propagation (the first one tried if adaptive)
 	// sstep: Saving interval for output vector
 	// Returns the saved positions, velocities (if use_vel = true) and time
 	// for each sampling position (if use_time = true)
@@ -37,10 +332,26 @@ public:
 	std::vector<EulerElements<use_vel, use_time>> propagate(double tfor, double tstep, double sstep);
 
 
-	// Start time is seconds since J2000
-	void init(double start_time, const EulerElements<true>& initial);
+	// Amplitude below which terms are summed in float in Mixed precision
+	double mixed_precision_au;
+
+	// Start time is seconds since J2000. The precision is this propagator's
+	// own, other propagators keep theirs (and their fits).
+	void init(double start_time, const EulerElements<true>& initial,
+			  EphemerisPrecision precision = EphemerisPrecision::Double);
+
+	// Ephemeris evaluations served from / missing the memo. Taylor takes its
+	// series from ephemeris_cache directly and counts in neither.
+	size_t get_ephemeris_hits() const { return memo_hits; }
+	size_t get_ephemeris_misses() const { return memo_misses; }
+	// Calls to f() since construction, Taylor expansions counted as
+	// TAYLOR_EXPANSION_COST of them
+	size_t get_force_evaluations() const { return force_evaluations; }
+	// Whether p was included by the last propagate call
+	bool planet_active(Planet p) const { return planets_active[(int)p]; }
 
 	Propagator();
+	~Propagator();
 
 };
 
@@ -0,0 +1,75 @@
+#include "SimdTier.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+SimdTier simd_supported()
+{
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f"))
+	{
+		return SimdTier::AVX512;
+	}
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+	{
+		return SimdTier::AVX2;
+	}
+	if(__builtin_cpu_supports("sse2"))
+	{
+		return SimdTier::SSE2;
+	}
+#endif
+	return SimdTier::Scalar;
+}
+
+static SimdTier select_tier()
+{
+	SimdTier best = simd_supported();
+
+	const char* env = std::getenv("PROPAGATOR_SIMD");
+	if(env == nullptr || *env == '\0')
+	{
+		return best;
+	}
+
+	const SimdTier tiers[] = {SimdTier::Scalar, SimdTier::SSE2, SimdTier::AVX2, SimdTier::AVX512};
+	for(SimdTier tier : tiers)
+	{
+		if(std::strcmp(env, simd_tier_name(tier)) == 0)
+		{
+			if(tier > best)
+			{
+				std::cerr << "PROPAGATOR_SIMD=" << env << " is not supported by this CPU, using "
+						  << simd_tier_name(best) << std::endl;
+				return best;
+			}
+			return tier;
+		}
+	}
+
+	std::cerr << "Unknown PROPAGATOR_SIMD=" << env << ", using " << simd_tier_name(best) << std::endl;
+	return best;
+}
+
+SimdTier simd_tier()
+{
+	static const SimdTier tier = select_tier();
+	return tier;
+}
+
+const char* simd_tier_name(SimdTier tier)
+{
+	switch(tier)
+	{
+	case SimdTier::Scalar:
+		return "scalar";
+	case SimdTier::SSE2:
+		return "sse2";
+	case SimdTier::AVX2:
+		return "avx2";
+	case SimdTier::AVX512:
+		return "avx512";
+	}
+	return "unknown";
+}
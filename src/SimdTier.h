@@ -0,0 +1,22 @@
+#pragma once
+
+// Instruction set levels of the hot kernels, from worst to best. Kernels are
+// built once per tier regardless of the compiler flags, and the one to run is
+// picked at startup, so the same binary works on any x86-64.
+enum class SimdTier
+{
+	Scalar,
+	SSE2,
+	AVX2,
+	AVX512
+};
+
+// Best tier the CPU supports
+SimdTier simd_supported();
+
+// Tier the kernels use, decided on the first call: simd_supported(), unless
+// the environment variable PROPAGATOR_SIMD (scalar, sse2, avx2 or avx512)
+// asks for another one. Tiers above the supported one are not honored.
+SimdTier simd_tier();
+
+const char* simd_tier_name(SimdTier tier);
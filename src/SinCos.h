@@ -0,0 +1,452 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+// Polynomial sin / cos for the propagator, in place of libm.
+//
+// Arguments are reduced to r in [-pi/4, pi/4] with q = round(x * 2/pi) and
+// r = x - q * pi/2 (Cody-Waite, pi/2 split in three parts), then fed to the
+// fdlibm sin / cos kernels. The reduction is exact enough for |q| < 2^20, that
+// is |x| < SINCOS_MAX_ARG (~1.6e6 rad), which covers every VSOP87 argument
+// B + C*t over the span of the theory (|C| < 2.9e5, |t| < 4 millennia). Larger
+// arguments are passed to libm, which does the full Payne-Hanek reduction.
+//
+// Error against a long double reference (0.5 ulp being correctly rounded),
+// measured on 2^21 random arguments per range:
+//  - |x| < pi/4: 0.72 ulp for sin, 1.25 ulp for cos
+//  - |x| < SINCOS_MAX_ARG: 2.35 ulp, or 1.6 ulp for the FMA variants (the
+//    rounding of the reduced argument adds up to one more ulp)
+//
+// Variants (the FMA ones reduce with a full double split of pi/2, so results
+// can differ from the others in the last bit):
+//  - fast_sincos / fast_sin / fast_cos: scalar, any target
+//  - fast_sincos_sse2: 2 lanes, baseline x86-64
+//  - fast_sincos_avx2: 4 lanes, needs AVX2 and FMA
+//  - fast_sincos_avx512: 8 lanes, needs AVX-512F
+//  - fast_sincos_array: widest variant available, over arrays
+//
+// Everything has internal linkage, so translation units built for different
+// instruction sets (see SimdTier.h) never end up sharing a copy.
+
+static constexpr double SINCOS_MAX_ARG = 1048576.0 * 1.5707963267948966;
+
+static constexpr double SINCOS_TWO_OVER_PI = 0.6366197723675814;
+// pi/2 split in 33 bit parts, q * SINCOS_PIO2_1 is exact for |q| < 2^20
+static constexpr double SINCOS_PIO2_1 = 1.57079632673412561417e+00;
+static constexpr double SINCOS_PIO2_2 = 6.07710050630396597660e-11;
+static constexpr double SINCOS_PIO2_3 = 2.02226624871116645580e-21;
+// pi/2 split in full double parts, only valid together with fma
+static constexpr double SINCOS_PIO2_A = 1.5707963267948966;
+static constexpr double SINCOS_PIO2_B = 6.123233995736766e-17;
+static constexpr double SINCOS_PIO2_C = -1.4973849048591698e-33;
+// Adding 1.5 * 2^52 rounds to an integer, and leaves it in the low mantissa bits
+static constexpr double SINCOS_ROUND_MAGIC = 6755399441055744.0;
+
+// fdlibm __kernel_sin / __kernel_cos
+static constexpr double SINCOS_S1 = -1.66666666666666324348e-01;
+static constexpr double SINCOS_S2 = 8.33333333332248946124e-03;
+static constexpr double SINCOS_S3 = -1.98412698298579493134e-04;
+static constexpr double SINCOS_S4 = 2.75573137070700676789e-06;
+static constexpr double SINCOS_S5 = -2.50507602534068634195e-08;
+static constexpr double SINCOS_S6 = 1.58969099521155010221e-10;
+static constexpr double SINCOS_C1 = 4.16666666666666019037e-02;
+static constexpr double SINCOS_C2 = -1.38888888888741095749e-03;
+static constexpr double SINCOS_C3 = 2.48015872894767294178e-05;
+static constexpr double SINCOS_C4 = -2.75573143513906633035e-07;
+static constexpr double SINCOS_C5 = 2.08757232129817482790e-09;
+static constexpr double SINCOS_C6 = -1.13596475577881948265e-11;
+
+// Reduces x, returning r and z = r * r, and the quadrant in q
+static inline double sincos_reduce(double x, double& z, int64_t& q)
+{
+	double k = x * SINCOS_TWO_OVER_PI + SINCOS_ROUND_MAGIC;
+	double qd = k - SINCOS_ROUND_MAGIC;
+	int64_t bits;
+	std::memcpy(&bits, &k, sizeof(bits));
+	q = bits;
+
+	double r = x - qd * SINCOS_PIO2_1;
+	r = r - qd * SINCOS_PIO2_2;
+	r = r - qd * SINCOS_PIO2_3;
+	z = r * r;
+	return r;
+}
+
+static inline double sincos_kernel_sin(double r, double z)
+{
+	return r + r * z * (SINCOS_S1 + z * (SINCOS_S2 + z * (SINCOS_S3 + z * (SINCOS_S4 + z * (SINCOS_S5 + z * SINCOS_S6)))));
+}
+
+static inline double sincos_kernel_cos(double z)
+{
+	return 1.0 - 0.5 * z + z * z * (SINCOS_C1 + z * (SINCOS_C2 + z * (SINCOS_C3 + z * (SINCOS_C4 + z * (SINCOS_C5 + z * SINCOS_C6)))));
+}
+
+static inline void fast_sincos(double x, double& sn, double& cs)
+{
+	if(!(std::fabs(x) < SINCOS_MAX_ARG))
+	{
+		sn = std::sin(x);
+		cs = std::cos(x);
+		return;
+	}
+
+	double z;
+	int64_t q;
+	double r = sincos_reduce(x, z, q);
+	double s = sincos_kernel_sin(r, z);
+	double c = sincos_kernel_cos(z);
+	sn = (q & 1) ? c : s;
+	cs = (q & 1) ? s : c;
+	sn = (q & 2) ? -sn : sn;
+	cs = ((q + 1) & 2) ? -cs : cs;
+}
+
+static inline double fast_cos(double x)
+{
+	if(!(std::fabs(x) < SINCOS_MAX_ARG))
+	{
+		return std::cos(x);
+	}
+
+	double z;
+	int64_t q;
+	double r = sincos_reduce(x, z, q);
+	double out = (q & 1) ? sincos_kernel_sin(r, z) : sincos_kernel_cos(z);
+	return ((q + 1) & 2) ? -out : out;
+}
+
+static inline double fast_sin(double x)
+{
+	if(!(std::fabs(x) < SINCOS_MAX_ARG))
+	{
+		return std::sin(x);
+	}
+
+	double z;
+	int64_t q;
+	double r = sincos_reduce(x, z, q);
+	double out = (q & 1) ? sincos_kernel_cos(z) : sincos_kernel_sin(r, z);
+	return (q & 2) ? -out : out;
+}
+
+#if defined(__SSE2__)
+
+static inline void fast_sincos_sse2(__m128d x, __m128d& sn, __m128d& cs)
+{
+	__m128d absx = _mm_andnot_pd(_mm_set1_pd(-0.0), x);
+	if(_mm_movemask_pd(_mm_cmplt_pd(absx, _mm_set1_pd(SINCOS_MAX_ARG))) != 3)
+	{
+		alignas(16) double in[2], s[2], c[2];
+		_mm_store_pd(in, x);
+		fast_sincos(in[0], s[0], c[0]);
+		fast_sincos(in[1], s[1], c[1]);
+		sn = _mm_load_pd(s);
+		cs = _mm_load_pd(c);
+		return;
+	}
+
+	// No round instruction before SSE4.1, so round with the magic constant
+	__m128d k = _mm_add_pd(_mm_mul_pd(x, _mm_set1_pd(SINCOS_TWO_OVER_PI)), _mm_set1_pd(SINCOS_ROUND_MAGIC));
+	__m128d q = _mm_sub_pd(k, _mm_set1_pd(SINCOS_ROUND_MAGIC));
+	__m128i qi = _mm_castpd_si128(k);
+	__m128d r = _mm_sub_pd(x, _mm_mul_pd(q, _mm_set1_pd(SINCOS_PIO2_1)));
+	r = _mm_sub_pd(r, _mm_mul_pd(q, _mm_set1_pd(SINCOS_PIO2_2)));
+	r = _mm_sub_pd(r, _mm_mul_pd(q, _mm_set1_pd(SINCOS_PIO2_3)));
+	__m128d z = _mm_mul_pd(r, r);
+
+	__m128d s = _mm_add_pd(_mm_mul_pd(z, _mm_set1_pd(SINCOS_S6)), _mm_set1_pd(SINCOS_S5));
+	s = _mm_add_pd(_mm_mul_pd(z, s), _mm_set1_pd(SINCOS_S4));
+	s = _mm_add_pd(_mm_mul_pd(z, s), _mm_set1_pd(SINCOS_S3));
+	s = _mm_add_pd(_mm_mul_pd(z, s), _mm_set1_pd(SINCOS_S2));
+	s = _mm_add_pd(_mm_mul_pd(z, s), _mm_set1_pd(SINCOS_S1));
+	s = _mm_add_pd(_mm_mul_pd(_mm_mul_pd(r, z), s), r);
+
+	__m128d c = _mm_add_pd(_mm_mul_pd(z, _mm_set1_pd(SINCOS_C6)), _mm_set1_pd(SINCOS_C5));
+	c = _mm_add_pd(_mm_mul_pd(z, c), _mm_set1_pd(SINCOS_C4));
+	c = _mm_add_pd(_mm_mul_pd(z, c), _mm_set1_pd(SINCOS_C3));
+	c = _mm_add_pd(_mm_mul_pd(z, c), _mm_set1_pd(SINCOS_C2));
+	c = _mm_add_pd(_mm_mul_pd(z, c), _mm_set1_pd(SINCOS_C1));
+	c = _mm_add_pd(_mm_mul_pd(_mm_mul_pd(z, z), c), _mm_sub_pd(_mm_set1_pd(1.0), _mm_mul_pd(_mm_set1_pd(0.5), z)));
+
+	// All ones where q is odd (no 64 bit compare in SSE2)
+	__m128d odd = _mm_castsi128_pd(_mm_sub_epi64(_mm_setzero_si128(), _mm_and_si128(qi, _mm_set1_epi64x(1))));
+	__m128i mask = _mm_set1_epi64x((long long)0x8000000000000000ULL);
+	__m128i ssign = _mm_and_si128(_mm_slli_epi64(qi, 62), mask);
+	__m128i csign = _mm_and_si128(_mm_slli_epi64(_mm_add_epi64(qi, _mm_set1_epi64x(1)), 62), mask);
+	__m128d sr = _mm_or_pd(_mm_and_pd(odd, c), _mm_andnot_pd(odd, s));
+	__m128d cr = _mm_or_pd(_mm_and_pd(odd, s), _mm_andnot_pd(odd, c));
+	sn = _mm_xor_pd(sr, _mm_castsi128_pd(ssign));
+	cs = _mm_xor_pd(cr, _mm_castsi128_pd(csign));
+}
+
+#endif
+
+#if defined(__AVX2__) && defined(__FMA__)
+
+static inline void fast_sincos_avx2(__m256d x, __m256d& sn, __m256d& cs)
+{
+	__m256d absx = _mm256_andnot_pd(_mm256_set1_pd(-0.0), x);
+	if(_mm256_movemask_pd(_mm256_cmp_pd(absx, _mm256_set1_pd(SINCOS_MAX_ARG), _CMP_LT_OQ)) != 15)
+	{
+		alignas(32) double in[4], s[4], c[4];
+		_mm256_store_pd(in, x);
+		for(int i = 0; i < 4; i++)
+		{
+			fast_sincos(in[i], s[i], c[i]);
+		}
+		sn = _mm256_load_pd(s);
+		cs = _mm256_load_pd(c);
+		return;
+	}
+
+	__m256d q = _mm256_round_pd(_mm256_mul_pd(x, _mm256_set1_pd(SINCOS_TWO_OVER_PI)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m256d r = _mm256_fnmadd_pd(q, _mm256_set1_pd(SINCOS_PIO2_A), x);
+	r = _mm256_fnmadd_pd(q, _mm256_set1_pd(SINCOS_PIO2_B), r);
+	r = _mm256_fnmadd_pd(q, _mm256_set1_pd(SINCOS_PIO2_C), r);
+	__m256i qi = _mm256_castpd_si256(_mm256_add_pd(q, _mm256_set1_pd(SINCOS_ROUND_MAGIC)));
+	__m256d z = _mm256_mul_pd(r, r);
+
+	__m256d s = _mm256_fmadd_pd(z, _mm256_set1_pd(SINCOS_S6), _mm256_set1_pd(SINCOS_S5));
+	s = _mm256_fmadd_pd(z, s, _mm256_set1_pd(SINCOS_S4));
+	s = _mm256_fmadd_pd(z, s, _mm256_set1_pd(SINCOS_S3));
+	s = _mm256_fmadd_pd(z, s, _mm256_set1_pd(SINCOS_S2));
+	s = _mm256_fmadd_pd(z, s, _mm256_set1_pd(SINCOS_S1));
+	s = _mm256_fmadd_pd(_mm256_mul_pd(r, z), s, r);
+
+	__m256d c = _mm256_fmadd_pd(z, _mm256_set1_pd(SINCOS_C6), _mm256_set1_pd(SINCOS_C5));
+	c = _mm256_fmadd_pd(z, c, _mm256_set1_pd(SINCOS_C4));
+	c = _mm256_fmadd_pd(z, c, _mm256_set1_pd(SINCOS_C3));
+	c = _mm256_fmadd_pd(z, c, _mm256_set1_pd(SINCOS_C2));
+	c = _mm256_fmadd_pd(z, c, _mm256_set1_pd(SINCOS_C1));
+	c = _mm256_fmadd_pd(_mm256_mul_pd(z, z), c, _mm256_fnmadd_pd(_mm256_set1_pd(0.5), z, _mm256_set1_pd(1.0)));
+
+	// blendv only looks at the sign bit, so move the bits we need up there
+	__m256d odd = _mm256_castsi256_pd(_mm256_slli_epi64(qi, 63));
+	__m256i mask = _mm256_set1_epi64x((long long)0x8000000000000000ULL);
+	__m256i ssign = _mm256_and_si256(_mm256_slli_epi64(qi, 62), mask);
+	__m256i csign = _mm256_and_si256(_mm256_slli_epi64(_mm256_add_epi64(qi, _mm256_set1_epi64x(1)), 62), mask);
+	sn = _mm256_xor_pd(_mm256_blendv_pd(s, c, odd), _mm256_castsi256_pd(ssign));
+	cs = _mm256_xor_pd(_mm256_blendv_pd(c, s, odd), _mm256_castsi256_pd(csign));
+}
+
+#endif
+
+#if defined(__AVX512F__)
+
+static inline void fast_sincos_avx512(__m512d x, __m512d& sn, __m512d& cs)
+{
+	__m512d absx = _mm512_abs_pd(x);
+	if(_mm512_cmp_pd_mask(absx, _mm512_set1_pd(SINCOS_MAX_ARG), _CMP_LT_OQ) != 0xFF)
+	{
+		alignas(64) double in[8], s[8], c[8];
+		_mm512_store_pd(in, x);
+		for(int i = 0; i < 8; i++)
+		{
+			fast_sincos(in[i], s[i], c[i]);
+		}
+		sn = _mm512_load_pd(s);
+		cs = _mm512_load_pd(c);
+		return;
+	}
+
+	__m512d q = _mm512_roundscale_pd(_mm512_mul_pd(x, _mm512_set1_pd(SINCOS_TWO_OVER_PI)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m512d r = _mm512_fnmadd_pd(q, _mm512_set1_pd(SINCOS_PIO2_A), x);
+	r = _mm512_fnmadd_pd(q, _mm512_set1_pd(SINCOS_PIO2_B), r);
+	r = _mm512_fnmadd_pd(q, _mm512_set1_pd(SINCOS_PIO2_C), r);
+	__m512i qi = _mm512_castpd_si512(_mm512_add_pd(q, _mm512_set1_pd(SINCOS_ROUND_MAGIC)));
+	__m512d z = _mm512_mul_pd(r, r);
+
+	__m512d s = _mm512_fmadd_pd(z, _mm512_set1_pd(SINCOS_S6), _mm512_set1_pd(SINCOS_S5));
+	s = _mm512_fmadd_pd(z, s, _mm512_set1_pd(SINCOS_S4));
+	s = _mm512_fmadd_pd(z, s, _mm512_set1_pd(SINCOS_S3));
+	s = _mm512_fmadd_pd(z, s, _mm512_set1_pd(SINCOS_S2));
+	s = _mm512_fmadd_pd(z, s, _mm512_set1_pd(SINCOS_S1));
+	s = _mm512_fmadd_pd(_mm512_mul_pd(r, z), s, r);
+
+	__m512d c = _mm512_fmadd_pd(z, _mm512_set1_pd(SINCOS_C6), _mm512_set1_pd(SINCOS_C5));
+	c = _mm512_fmadd_pd(z, c, _mm512_set1_pd(SINCOS_C4));
+	c = _mm512_fmadd_pd(z, c, _mm512_set1_pd(SINCOS_C3));
+	c = _mm512_fmadd_pd(z, c, _mm512_set1_pd(SINCOS_C2));
+	c = _mm512_fmadd_pd(z, c, _mm512_set1_pd(SINCOS_C1));
+	c = _mm512_fmadd_pd(_mm512_mul_pd(z, z), c, _mm512_fnmadd_pd(_mm512_set1_pd(0.5), z, _mm512_set1_pd(1.0)));
+
+	__mmask8 odd = _mm512_test_epi64_mask(qi, _mm512_set1_epi64(1));
+	__m512i mask = _mm512_set1_epi64((long long)0x8000000000000000ULL);
+	__m512i ssign = _mm512_and_si512(_mm512_slli_epi64(qi, 62), mask);
+	__m512i csign = _mm512_and_si512(_mm512_slli_epi64(_mm512_add_epi64(qi, _mm512_set1_epi64(1)), 62), mask);
+	sn = _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(_mm512_mask_blend_pd(odd, s, c)), ssign));
+	cs = _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(_mm512_mask_blend_pd(odd, c, s)), csign));
+}
+
+#endif
+
+// sn[i], cs[i] = sin(x[i] * scale), cos(x[i] * scale)
+static inline void fast_sincos_array(const double* x, double scale, size_t n, double* sn, double* cs)
+{
+	size_t i = 0;
+#if defined(__AVX512F__)
+	__m512d sc8 = _mm512_set1_pd(scale);
+	for(; i + 8 <= n; i += 8)
+	{
+		__m512d s, c;
+		fast_sincos_avx512(_mm512_mul_pd(_mm512_loadu_pd(x + i), sc8), s, c);
+		_mm512_storeu_pd(sn + i, s);
+		_mm512_storeu_pd(cs + i, c);
+	}
+#elif defined(__AVX2__) && defined(__FMA__)
+	__m256d sc4 = _mm256_set1_pd(scale);
+	for(; i + 4 <= n; i += 4)
+	{
+		__m256d s, c;
+		fast_sincos_avx2(_mm256_mul_pd(_mm256_loadu_pd(x + i), sc4), s, c);
+		_mm256_storeu_pd(sn + i, s);
+		_mm256_storeu_pd(cs + i, c);
+	}
+#elif defined(__SSE2__)
+	__m128d sc2 = _mm_set1_pd(scale);
+	for(; i + 2 <= n; i += 2)
+	{
+		__m128d s, c;
+		fast_sincos_sse2(_mm_mul_pd(_mm_loadu_pd(x + i), sc2), s, c);
+		_mm_storeu_pd(sn + i, s);
+		_mm_storeu_pd(cs + i, c);
+	}
+#endif
+	for(; i < n; i++)
+	{
+		fast_sincos(x[i] * scale, sn[i], cs[i]);
+	}
+}
+
+// Single precision cos (cephes cosf kernels), for terms whose size doesn't
+// need double. Valid for |x| < SINCOSF_MAX_ARG, with no fallback: callers keep
+// the argument small. Error against the cos of the (float) argument within
+// 9.3e-8, measured on |x| < 2000.
+
+static constexpr float SINCOSF_MAX_ARG = 65536.0f;
+
+static constexpr float SINCOSF_TWO_OVER_PI = 0.636619772f;
+// pi/2 in three parts, q * SINCOSF_PIO2_1 is exact for |q| < 2^16
+static constexpr float SINCOSF_PIO2_1 = 1.5703125f;
+static constexpr float SINCOSF_PIO2_2 = 4.837512969970703125e-4f;
+static constexpr float SINCOSF_PIO2_3 = 7.54978995489188216e-8f;
+// Adding 1.5 * 2^23 rounds to an integer, and leaves it in the low mantissa bits
+static constexpr float SINCOSF_ROUND_MAGIC = 12582912.0f;
+
+static constexpr float SINCOSF_S1 = -1.6666654611e-1f;
+static constexpr float SINCOSF_S2 = 8.3321608736e-3f;
+static constexpr float SINCOSF_S3 = -1.9515295891e-4f;
+static constexpr float SINCOSF_C1 = 4.166664568298827e-2f;
+static constexpr float SINCOSF_C2 = -1.388731625493765e-3f;
+static constexpr float SINCOSF_C3 = 2.443315711809948e-5f;
+
+static inline float fast_cosf(float x)
+{
+	float k = x * SINCOSF_TWO_OVER_PI + SINCOSF_ROUND_MAGIC;
+	float q = k - SINCOSF_ROUND_MAGIC;
+	int32_t qi;
+	std::memcpy(&qi, &k, sizeof(qi));
+
+	float r = x - q * SINCOSF_PIO2_1;
+	r = r - q * SINCOSF_PIO2_2;
+	r = r - q * SINCOSF_PIO2_3;
+	float z = r * r;
+	float out;
+	if(qi & 1)
+	{
+		out = r + r * z * (SINCOSF_S1 + z * (SINCOSF_S2 + z * SINCOSF_S3));
+	}
+	else
+	{
+		out = 1.0f - 0.5f * z + z * z * (SINCOSF_C1 + z * (SINCOSF_C2 + z * SINCOSF_C3));
+	}
+	return ((qi + 1) & 2) ? -out : out;
+}
+
+#if defined(__SSE2__)
+
+static inline __m128 fast_cosf_sse2(__m128 x)
+{
+	__m128 k = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(SINCOSF_TWO_OVER_PI)), _mm_set1_ps(SINCOSF_ROUND_MAGIC));
+	__m128 q = _mm_sub_ps(k, _mm_set1_ps(SINCOSF_ROUND_MAGIC));
+	__m128i qi = _mm_castps_si128(k);
+	__m128 r = _mm_sub_ps(x, _mm_mul_ps(q, _mm_set1_ps(SINCOSF_PIO2_1)));
+	r = _mm_sub_ps(r, _mm_mul_ps(q, _mm_set1_ps(SINCOSF_PIO2_2)));
+	r = _mm_sub_ps(r, _mm_mul_ps(q, _mm_set1_ps(SINCOSF_PIO2_3)));
+	__m128 z = _mm_mul_ps(r, r);
+
+	__m128 s = _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(SINCOSF_S3)), _mm_set1_ps(SINCOSF_S2));
+	s = _mm_add_ps(_mm_mul_ps(z, s), _mm_set1_ps(SINCOSF_S1));
+	s = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(r, z), s), r);
+
+	__m128 c = _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(SINCOSF_C3)), _mm_set1_ps(SINCOSF_C2));
+	c = _mm_add_ps(_mm_mul_ps(z, c), _mm_set1_ps(SINCOSF_C1));
+	c = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(z, z), c), _mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(_mm_set1_ps(0.5f), z)));
+
+	__m128 odd = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(qi, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+	__m128i sign = _mm_slli_epi32(_mm_srli_epi32(_mm_add_epi32(qi, _mm_set1_epi32(1)), 1), 31);
+	__m128 out = _mm_or_ps(_mm_and_ps(odd, s), _mm_andnot_ps(odd, c));
+	return _mm_xor_ps(out, _mm_castsi128_ps(sign));
+}
+
+#endif
+
+#if defined(__AVX2__) && defined(__FMA__)
+
+static inline __m256 fast_cosf_avx2(__m256 x)
+{
+	__m256 q = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(SINCOSF_TWO_OVER_PI)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m256 r = _mm256_fnmadd_ps(q, _mm256_set1_ps(SINCOSF_PIO2_1), x);
+	r = _mm256_fnmadd_ps(q, _mm256_set1_ps(SINCOSF_PIO2_2), r);
+	r = _mm256_fnmadd_ps(q, _mm256_set1_ps(SINCOSF_PIO2_3), r);
+	__m256i qi = _mm256_cvtps_epi32(q);
+	__m256 z = _mm256_mul_ps(r, r);
+
+	__m256 s = _mm256_fmadd_ps(z, _mm256_set1_ps(SINCOSF_S3), _mm256_set1_ps(SINCOSF_S2));
+	s = _mm256_fmadd_ps(z, s, _mm256_set1_ps(SINCOSF_S1));
+	s = _mm256_fmadd_ps(_mm256_mul_ps(r, z), s, r);
+
+	__m256 c = _mm256_fmadd_ps(z, _mm256_set1_ps(SINCOSF_C3), _mm256_set1_ps(SINCOSF_C2));
+	c = _mm256_fmadd_ps(z, c, _mm256_set1_ps(SINCOSF_C1));
+	c = _mm256_fmadd_ps(_mm256_mul_ps(z, z), c, _mm256_fnmadd_ps(_mm256_set1_ps(0.5f), z, _mm256_set1_ps(1.0f)));
+
+	// blendv only looks at the sign bit, so move the bits we need up there
+	__m256 odd = _mm256_castsi256_ps(_mm256_slli_epi32(qi, 31));
+	__m256i sign = _mm256_slli_epi32(_mm256_srli_epi32(_mm256_add_epi32(qi, _mm256_set1_epi32(1)), 1), 31);
+	return _mm256_xor_ps(_mm256_blendv_ps(c, s, odd), _mm256_castsi256_ps(sign));
+}
+
+#endif
+
+#if defined(__AVX512F__)
+
+static inline __m512 fast_cosf_avx512(__m512 x)
+{
+	__m512 q = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(SINCOSF_TWO_OVER_PI)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m512 r = _mm512_fnmadd_ps(q, _mm512_set1_ps(SINCOSF_PIO2_1), x);
+	r = _mm512_fnmadd_ps(q, _mm512_set1_ps(SINCOSF_PIO2_2), r);
+	r = _mm512_fnmadd_ps(q, _mm512_set1_ps(SINCOSF_PIO2_3), r);
+	__m512i qi = _mm512_cvtps_epi32(q);
+	__m512 z = _mm512_mul_ps(r, r);
+
+	__m512 s = _mm512_fmadd_ps(z, _mm512_set1_ps(SINCOSF_S3), _mm512_set1_ps(SINCOSF_S2));
+	s = _mm512_fmadd_ps(z, s, _mm512_set1_ps(SINCOSF_S1));
+	s = _mm512_fmadd_ps(_mm512_mul_ps(r, z), s, r);
+
+	__m512 c = _mm512_fmadd_ps(z, _mm512_set1_ps(SINCOSF_C3), _mm512_set1_ps(SINCOSF_C2));
+	c = _mm512_fmadd_ps(z, c, _mm512_set1_ps(SINCOSF_C1));
+	c = _mm512_fmadd_ps(_mm512_mul_ps(z, z), c, _mm512_fnmadd_ps(_mm512_set1_ps(0.5f), z, _mm512_set1_ps(1.0f)));
+
+	__mmask16 odd = _mm512_test_epi32_mask(qi, _mm512_set1_epi32(1));
+	__m512i sign = _mm512_slli_epi32(_mm512_srli_epi32(_mm512_add_epi32(qi, _mm512_set1_epi32(1)), 1), 31);
+	__m512 out = _mm512_mask_blend_ps(odd, c, s);
+	return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(out), sign));
+}
+
+#endif
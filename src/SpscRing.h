@@ -0,0 +1,57 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+
+// Lock-free ring buffer for exactly one producer and one consumer thread.
+// N must be a power of two.
+template<typename T, size_t N>
+class SpscRing
+{
+private:
+
+	static_assert(N > 0 && (N & (N - 1)) == 0, "Ring size must be a power of two");
+
+	T items[N];
+	// Total pops (written by the consumer) and pushes (written by the
+	// producer), kept on separate cache lines
+	alignas(64) std::atomic<size_t> head;
+	alignas(64) std::atomic<size_t> tail;
+
+public:
+
+	// Producer side, false if full
+	bool push(const T& item)
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+		if(t - head.load(std::memory_order_acquire) == N)
+		{
+			return false;
+		}
+		items[t & (N - 1)] = item;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side, false if empty
+	bool pop(T& item)
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		if(h == tail.load(std::memory_order_acquire))
+		{
+			return false;
+		}
+		item = items[h & (N - 1)];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Only while neither side is running
+	void clear()
+	{
+		head.store(0, std::memory_order_relaxed);
+		tail.store(0, std::memory_order_relaxed);
+	}
+
+	SpscRing() : head(0), tail(0) {}
+
+};
@@ -0,0 +1,38 @@
+//VSOP87-Multilang http://www.astrogreg.com/vsop87-multilang/index.html
+//Greg Miller (gmiller@gregmiller.net) 2019.  Released as Public Domain
+
+#ifndef VSOP87A_KERNELS
+#define VSOP87A_KERNELS
+
+#include "vsop87a_large.h"
+
+//Small terms of a series in single precision, with phases taken at some
+//epoch t0 so only C*(t - t0) has to be evaluated
+struct vsop87a_tail_series{
+   const float* a;
+   const float* b;
+   const float* c;
+   int n;
+};
+
+//Series summation of vsop87a_large for one instruction set tier
+struct vsop87a_kernels{
+   double (*sum)(const vsop87a_series& series,double t);
+   void (*sumPosVel)(const vsop87a_series& series,double t,double& pos,double& rate);
+   //acc[e] += value at t[e]
+   void (*sumBatch)(const vsop87a_series& series,const double* t,int n,double* acc);
+   //sn[i], cs[i] = sin(c[i]*t), cos(c[i]*t)
+   void (*sincosScaled)(const double* c,double t,int n,double* sn,double* cs);
+   //Sum of the tail at t0 + dt, in float lanes
+   double (*sumTail)(const vsop87a_tail_series& series,float dt);
+};
+
+extern const vsop87a_kernels vsop87a_kernels_scalar;
+extern const vsop87a_kernels vsop87a_kernels_sse2;
+extern const vsop87a_kernels vsop87a_kernels_avx2;
+extern const vsop87a_kernels vsop87a_kernels_avx512;
+
+//Kernels for simd_tier(), picked on first use
+const vsop87a_kernels& vsop87a_active_kernels();
+
+#endif
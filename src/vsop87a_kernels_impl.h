@@ -0,0 +1,342 @@
+//VSOP87-Multilang http://www.astrogreg.com/vsop87-multilang/index.html
+//Greg Miller (gmiller@gregmiller.net) 2019.  Released as Public Domain
+
+//Summation kernels of vsop87a_large, using the polynomial sin/cos of
+//SinCos.h. Included once per tier by vsop87a_kernels_<tier>.cpp, each one
+//built with its own target flags and defining VSOP87A_KERNEL_<TIER> and
+//VSOP87A_KERNEL_NAME. A tier the compiler can't target falls back to scalar.
+//Everything here must have internal linkage, as the same inline function
+//compiled for different targets would otherwise be merged by the linker.
+
+#include "vsop87a_kernels.h"
+#include "SinCos.h"
+
+#if defined(VSOP87A_KERNEL_AVX512) && defined(__AVX512F__)
+
+static inline __m512d cos8(__m512d x){
+   __m512d sn,cs;
+   fast_sincos_avx512(x,sn,cs);
+   return cs;
+}
+
+static void sincosScaled(const double* c,double t,int n,double* sn,double* cs){
+   __m512d tt=_mm512_set1_pd(t);
+   int i=0;
+   for(;i+8<=n;i+=8){
+      __m512d s,k;
+      fast_sincos_avx512(_mm512_mul_pd(_mm512_loadu_pd(c+i),tt),s,k);
+      _mm512_storeu_pd(sn+i,s);
+      _mm512_storeu_pd(cs+i,k);
+   }
+   for(;i<n;i++){
+      fast_sincos(c[i]*t,sn[i],cs[i]);
+   }
+}
+
+static double sumTail(const vsop87a_tail_series& series,float dt){
+   __m512 tt=_mm512_set1_ps(dt);
+   __m512 acc=_mm512_setzero_ps();
+   int i=0;
+   for(;i+16<=series.n;i+=16){
+      __m512 x=_mm512_fmadd_ps(_mm512_loadu_ps(series.c+i),tt,_mm512_loadu_ps(series.b+i));
+      acc=_mm512_fmadd_ps(_mm512_loadu_ps(series.a+i),fast_cosf_avx512(x),acc);
+   }
+   double out=_mm512_reduce_add_ps(acc);
+   for(;i<series.n;i++){
+      out+=series.a[i]*fast_cosf(series.b[i]+series.c[i]*dt);
+   }
+   return out;
+}
+
+static double sum(const vsop87a_series& series,double t){
+   __m512d tt=_mm512_set1_pd(t);
+   __m512d acc=_mm512_setzero_pd();
+   int i=0;
+   for(;i+8<=series.n;i+=8){
+      __m512d x=_mm512_add_pd(_mm512_loadu_pd(series.b+i),_mm512_mul_pd(_mm512_loadu_pd(series.c+i),tt));
+      acc=_mm512_fmadd_pd(_mm512_loadu_pd(series.a+i),cos8(x),acc);
+   }
+   double out=_mm512_reduce_add_pd(acc);
+   for(;i<series.n;i++){
+      out+=series.a[i]*fast_cos(series.b[i]+series.c[i]*t);
+   }
+   return out;
+}
+
+static void sumBatch(const vsop87a_series& series,const double* t,int n,double* acc){
+   for(int j=0;j<series.n;j++){
+      __m512d a=_mm512_set1_pd(series.a[j]);
+      __m512d b=_mm512_set1_pd(series.b[j]);
+      __m512d c=_mm512_set1_pd(series.c[j]);
+      int e=0;
+      for(;e+8<=n;e+=8){
+         __m512d x=_mm512_add_pd(b,_mm512_mul_pd(c,_mm512_loadu_pd(t+e)));
+         _mm512_storeu_pd(acc+e,_mm512_fmadd_pd(a,cos8(x),_mm512_loadu_pd(acc+e)));
+      }
+      for(;e<n;e++){
+         acc[e]+=series.a[j]*fast_cos(series.b[j]+series.c[j]*t[e]);
+      }
+   }
+}
+
+static void sumPosVel(const vsop87a_series& series,double t,double& pos,double& rate){
+   __m512d tt=_mm512_set1_pd(t);
+   __m512d acc=_mm512_setzero_pd();
+   __m512d dacc=_mm512_setzero_pd();
+   int i=0;
+   for(;i+8<=series.n;i+=8){
+      __m512d a=_mm512_loadu_pd(series.a+i);
+      __m512d c=_mm512_loadu_pd(series.c+i);
+      __m512d sn,cs;
+      fast_sincos_avx512(_mm512_add_pd(_mm512_loadu_pd(series.b+i),_mm512_mul_pd(c,tt)),sn,cs);
+      acc=_mm512_fmadd_pd(a,cs,acc);
+      dacc=_mm512_fmadd_pd(_mm512_mul_pd(a,c),sn,dacc);
+   }
+   pos=_mm512_reduce_add_pd(acc);
+   rate=_mm512_reduce_add_pd(dacc);
+   for(;i<series.n;i++){
+      double sn,cs;
+      fast_sincos(series.b[i]+series.c[i]*t,sn,cs);
+      pos+=series.a[i]*cs;
+      rate+=series.a[i]*series.c[i]*sn;
+   }
+}
+
+#elif defined(VSOP87A_KERNEL_AVX2) && defined(__AVX2__) && defined(__FMA__)
+
+static inline __m256d cos4(__m256d x){
+   __m256d sn,cs;
+   fast_sincos_avx2(x,sn,cs);
+   return cs;
+}
+
+static void sincosScaled(const double* c,double t,int n,double* sn,double* cs){
+   __m256d tt=_mm256_set1_pd(t);
+   int i=0;
+   for(;i+4<=n;i+=4){
+      __m256d s,k;
+      fast_sincos_avx2(_mm256_mul_pd(_mm256_loadu_pd(c+i),tt),s,k);
+      _mm256_storeu_pd(sn+i,s);
+      _mm256_storeu_pd(cs+i,k);
+   }
+   for(;i<n;i++){
+      fast_sincos(c[i]*t,sn[i],cs[i]);
+   }
+}
+
+static double sumTail(const vsop87a_tail_series& series,float dt){
+   __m256 tt=_mm256_set1_ps(dt);
+   __m256 acc=_mm256_setzero_ps();
+   int i=0;
+   for(;i+8<=series.n;i+=8){
+      __m256 x=_mm256_fmadd_ps(_mm256_loadu_ps(series.c+i),tt,_mm256_loadu_ps(series.b+i));
+      acc=_mm256_fmadd_ps(_mm256_loadu_ps(series.a+i),fast_cosf_avx2(x),acc);
+   }
+   __m128 half=_mm_add_ps(_mm256_castps256_ps128(acc),_mm256_extractf128_ps(acc,1));
+   half=_mm_add_ps(half,_mm_movehl_ps(half,half));
+   double out=_mm_cvtss_f32(_mm_add_ss(half,_mm_shuffle_ps(half,half,1)));
+   for(;i<series.n;i++){
+      out+=series.a[i]*fast_cosf(series.b[i]+series.c[i]*dt);
+   }
+   return out;
+}
+
+static double sum(const vsop87a_series& series,double t){
+   __m256d tt=_mm256_set1_pd(t);
+   __m256d acc=_mm256_setzero_pd();
+   int i=0;
+   for(;i+4<=series.n;i+=4){
+      __m256d x=_mm256_add_pd(_mm256_loadu_pd(series.b+i),_mm256_mul_pd(_mm256_loadu_pd(series.c+i),tt));
+      acc=_mm256_fmadd_pd(_mm256_loadu_pd(series.a+i),cos4(x),acc);
+   }
+   __m128d half=_mm_add_pd(_mm256_castpd256_pd128(acc),_mm256_extractf128_pd(acc,1));
+   double out=_mm_cvtsd_f64(_mm_add_sd(half,_mm_unpackhi_pd(half,half)));
+   for(;i<series.n;i++){
+      out+=series.a[i]*fast_cos(series.b[i]+series.c[i]*t);
+   }
+   return out;
+}
+
+static void sumBatch(const vsop87a_series& series,const double* t,int n,double* acc){
+   for(int j=0;j<series.n;j++){
+      __m256d a=_mm256_set1_pd(series.a[j]);
+      __m256d b=_mm256_set1_pd(series.b[j]);
+      __m256d c=_mm256_set1_pd(series.c[j]);
+      int e=0;
+      for(;e+4<=n;e+=4){
+         __m256d x=_mm256_add_pd(b,_mm256_mul_pd(c,_mm256_loadu_pd(t+e)));
+         _mm256_storeu_pd(acc+e,_mm256_fmadd_pd(a,cos4(x),_mm256_loadu_pd(acc+e)));
+      }
+      for(;e<n;e++){
+         acc[e]+=series.a[j]*fast_cos(series.b[j]+series.c[j]*t[e]);
+      }
+   }
+}
+
+static void sumPosVel(const vsop87a_series& series,double t,double& pos,double& rate){
+   __m256d tt=_mm256_set1_pd(t);
+   __m256d acc=_mm256_setzero_pd();
+   __m256d dacc=_mm256_setzero_pd();
+   int i=0;
+   for(;i+4<=series.n;i+=4){
+      __m256d a=_mm256_loadu_pd(series.a+i);
+      __m256d c=_mm256_loadu_pd(series.c+i);
+      __m256d sn,cs;
+      fast_sincos_avx2(_mm256_add_pd(_mm256_loadu_pd(series.b+i),_mm256_mul_pd(c,tt)),sn,cs);
+      acc=_mm256_fmadd_pd(a,cs,acc);
+      dacc=_mm256_fmadd_pd(_mm256_mul_pd(a,c),sn,dacc);
+   }
+   __m128d half=_mm_add_pd(_mm256_castpd256_pd128(acc),_mm256_extractf128_pd(acc,1));
+   pos=_mm_cvtsd_f64(_mm_add_sd(half,_mm_unpackhi_pd(half,half)));
+   half=_mm_add_pd(_mm256_castpd256_pd128(dacc),_mm256_extractf128_pd(dacc,1));
+   rate=_mm_cvtsd_f64(_mm_add_sd(half,_mm_unpackhi_pd(half,half)));
+   for(;i<series.n;i++){
+      double sn,cs;
+      fast_sincos(series.b[i]+series.c[i]*t,sn,cs);
+      pos+=series.a[i]*cs;
+      rate+=series.a[i]*series.c[i]*sn;
+   }
+}
+
+#elif defined(VSOP87A_KERNEL_SSE2) && defined(__SSE2__)
+
+static inline __m128d cos2(__m128d x){
+   __m128d sn,cs;
+   fast_sincos_sse2(x,sn,cs);
+   return cs;
+}
+
+static inline double hsum2(__m128d v){
+   return _mm_cvtsd_f64(_mm_add_sd(v,_mm_unpackhi_pd(v,v)));
+}
+
+static void sincosScaled(const double* c,double t,int n,double* sn,double* cs){
+   __m128d tt=_mm_set1_pd(t);
+   int i=0;
+   for(;i+2<=n;i+=2){
+      __m128d s,k;
+      fast_sincos_sse2(_mm_mul_pd(_mm_loadu_pd(c+i),tt),s,k);
+      _mm_storeu_pd(sn+i,s);
+      _mm_storeu_pd(cs+i,k);
+   }
+   for(;i<n;i++){
+      fast_sincos(c[i]*t,sn[i],cs[i]);
+   }
+}
+
+static double sumTail(const vsop87a_tail_series& series,float dt){
+   __m128 tt=_mm_set1_ps(dt);
+   __m128 acc=_mm_setzero_ps();
+   int i=0;
+   for(;i+4<=series.n;i+=4){
+      __m128 x=_mm_add_ps(_mm_loadu_ps(series.b+i),_mm_mul_ps(_mm_loadu_ps(series.c+i),tt));
+      acc=_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(series.a+i),fast_cosf_sse2(x)),acc);
+   }
+   __m128 half=_mm_add_ps(acc,_mm_movehl_ps(acc,acc));
+   double out=_mm_cvtss_f32(_mm_add_ss(half,_mm_shuffle_ps(half,half,1)));
+   for(;i<series.n;i++){
+      out+=series.a[i]*fast_cosf(series.b[i]+series.c[i]*dt);
+   }
+   return out;
+}
+
+static double sum(const vsop87a_series& series,double t){
+   __m128d tt=_mm_set1_pd(t);
+   __m128d acc=_mm_setzero_pd();
+   int i=0;
+   for(;i+2<=series.n;i+=2){
+      __m128d x=_mm_add_pd(_mm_loadu_pd(series.b+i),_mm_mul_pd(_mm_loadu_pd(series.c+i),tt));
+      acc=_mm_add_pd(_mm_mul_pd(_mm_loadu_pd(series.a+i),cos2(x)),acc);
+   }
+   double out=hsum2(acc);
+   for(;i<series.n;i++){
+      out+=series.a[i]*fast_cos(series.b[i]+series.c[i]*t);
+   }
+   return out;
+}
+
+static void sumBatch(const vsop87a_series& series,const double* t,int n,double* acc){
+   for(int j=0;j<series.n;j++){
+      __m128d a=_mm_set1_pd(series.a[j]);
+      __m128d b=_mm_set1_pd(series.b[j]);
+      __m128d c=_mm_set1_pd(series.c[j]);
+      int e=0;
+      for(;e+2<=n;e+=2){
+         __m128d x=_mm_add_pd(b,_mm_mul_pd(c,_mm_loadu_pd(t+e)));
+         _mm_storeu_pd(acc+e,_mm_add_pd(_mm_mul_pd(a,cos2(x)),_mm_loadu_pd(acc+e)));
+      }
+      for(;e<n;e++){
+         acc[e]+=series.a[j]*fast_cos(series.b[j]+series.c[j]*t[e]);
+      }
+   }
+}
+
+static void sumPosVel(const vsop87a_series& series,double t,double& pos,double& rate){
+   __m128d tt=_mm_set1_pd(t);
+   __m128d acc=_mm_setzero_pd();
+   __m128d dacc=_mm_setzero_pd();
+   int i=0;
+   for(;i+2<=series.n;i+=2){
+      __m128d a=_mm_loadu_pd(series.a+i);
+      __m128d c=_mm_loadu_pd(series.c+i);
+      __m128d sn,cs;
+      fast_sincos_sse2(_mm_add_pd(_mm_loadu_pd(series.b+i),_mm_mul_pd(c,tt)),sn,cs);
+      acc=_mm_add_pd(_mm_mul_pd(a,cs),acc);
+      dacc=_mm_add_pd(_mm_mul_pd(_mm_mul_pd(a,c),sn),dacc);
+   }
+   pos=hsum2(acc);
+   rate=hsum2(dacc);
+   for(;i<series.n;i++){
+      double sn,cs;
+      fast_sincos(series.b[i]+series.c[i]*t,sn,cs);
+      pos+=series.a[i]*cs;
+      rate+=series.a[i]*series.c[i]*sn;
+   }
+}
+
+#else
+
+static void sincosScaled(const double* c,double t,int n,double* sn,double* cs){
+   for(int i=0;i<n;i++){
+      fast_sincos(c[i]*t,sn[i],cs[i]);
+   }
+}
+
+static double sumTail(const vsop87a_tail_series& series,float dt){
+   float out=0.0f;
+   for(int i=0;i<series.n;i++){
+      out+=series.a[i]*fast_cosf(series.b[i]+series.c[i]*dt);
+   }
+   return out;
+}
+
+static double sum(const vsop87a_series& series,double t){
+   double out=0.0;
+   for(int i=0;i<series.n;i++){
+      out+=series.a[i]*fast_cos(series.b[i]+series.c[i]*t);
+   }
+   return out;
+}
+
+static void sumBatch(const vsop87a_series& series,const double* t,int n,double* acc){
+   for(int j=0;j<series.n;j++){
+      for(int e=0;e<n;e++){
+         acc[e]+=series.a[j]*fast_cos(series.b[j]+series.c[j]*t[e]);
+      }
+   }
+}
+
+static void sumPosVel(const vsop87a_series& series,double t,double& pos,double& rate){
+   pos=0.0;
+   rate=0.0;
+   for(int i=0;i<series.n;i++){
+      double sn,cs;
+      fast_sincos(series.b[i]+series.c[i]*t,sn,cs);
+      pos+=series.a[i]*cs;
+      rate+=series.a[i]*series.c[i]*sn;
+   }
+}
+
+#endif
+
+const vsop87a_kernels VSOP87A_KERNEL_NAME={sum,sumPosVel,sumBatch,sincosScaled,sumTail};
@@ -0,0 +1,3 @@
+#define VSOP87A_KERNEL_SCALAR
+#define VSOP87A_KERNEL_NAME vsop87a_kernels_scalar
+#include "vsop87a_kernels_impl.h"
@@ -0,0 +1,3 @@
+#define VSOP87A_KERNEL_SSE2
+#define VSOP87A_KERNEL_NAME vsop87a_kernels_sse2
+#include "vsop87a_kernels_impl.h"
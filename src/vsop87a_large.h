@@ -4,46 +4,208 @@
 #ifndef VSOP87A_LARGE
 #define VSOP87A_LARGE
 
+#include <cstddef>
+#include <vector>
+
+//Only the bodies with VSOP87A_HAS_<BODY> defined are compiled in (tables and
+//functions), so using any other one fails to build. The build defines
+//VSOP87A_SELECT_BODIES along with the chosen ones, without it all are kept.
+#ifndef VSOP87A_SELECT_BODIES
+#define VSOP87A_HAS_EARTH
+#define VSOP87A_HAS_EMB
+#define VSOP87A_HAS_JUPITER
+#define VSOP87A_HAS_MARS
+#define VSOP87A_HAS_MERCURY
+#define VSOP87A_HAS_NEPTUNE
+#define VSOP87A_HAS_SATURN
+#define VSOP87A_HAS_URANUS
+#define VSOP87A_HAS_VENUS
+#endif
+
+//Terms of one coordinate for one power of t, each one being A * cos(B + C*t).
+//Stored as structure-of-arrays so the summation kernel can stream them.
+struct vsop87a_series{
+   const double* a;
+   const double* b;
+   const double* c;
+   int n;
+};
+
+//x, y, z series of a body for t^0 ... t^5 (unused powers have n = 0)
+struct vsop87a_body{
+   vsop87a_series s[3][6];
+};
+
+struct vsop87a_split;
+
+//Mixed precision split of the active tables: terms with |A| < au are summed in
+//float lanes, with their phases taken at t0 so only C*(t - t0) is rounded to
+//float, and the rest in double. Evaluations given one sum that way within
+//getMixedSpan() of t0, elsewhere (or once the active tables changed since
+//init) they sum in double. Each instance is independent of the others.
+class vsop87a_mixed{
+   public:
+   vsop87a_mixed();
+   ~vsop87a_mixed();
+   //au <= 0 leaves it empty, summing in double
+   void init(double au,double t0);
+   //False once the active tables changed, init again to follow them
+   bool current() const;
+   //Threshold in use, 0 when empty
+   double getThreshold() const;
+   double getStart() const;
+
+   private:
+   friend class vsop87a_large;
+   double au;
+   double t0;
+   int version;
+   std::vector<vsop87a_split> split;
+};
+
 class vsop87a_large{
    public:
-   static void getEarth(double t,double temp[]);
-   static void getEmb(double t,double temp[]);
-   static void getJupiter(double t,double temp[]);
-   static void getMars(double t,double temp[]);
-   static void getMercury(double t,double temp[]);
-   static void getNeptune(double t,double temp[]);
-   static void getSaturn(double t,double temp[]);
-   static void getUranus(double t,double temp[]);
-   static void getVenus(double t,double temp[]);
+   //getX: position in AU for t in julian millennia since J2000.
+   //getXVel: analytic time derivative in AU per julian millennium, sharing
+   //the sincos of every term with the position (the PosVel versions cost about
+   //the same as a position alone). getMoon also works on velocities.
+   //getXBatch: n epochs at once, xyz holds x, y, z for each epoch in turn.
+   //Terms are looped outside so the epochs vectorize.
+   //getX sums the small terms in float if given a vsop87a_mixed.
+#ifdef VSOP87A_HAS_EARTH
+   static void getEarth(double t,double temp[],const vsop87a_mixed* mixed=nullptr);
+   static void getEarthVel(double t,double temp[]);
+   static void getEarthPosVel(double t,double pos[],double vel[]);
+   static void getEarthBatch(const double* t,size_t n,double* xyz);
+   static const vsop87a_body earth_series;
+#endif
+#ifdef VSOP87A_HAS_EMB
+   static void getEmb(double t,double temp[],const vsop87a_mixed* mixed=nullptr);
+   static void getEmbVel(double t,double temp[]);
+   static void getEmbPosVel(double t,double pos[],double vel[]);
+   static void getEmbBatch(const double* t,size_t n,double* xyz);
+   static const vsop87a_body emb_series;
+#endif
+#ifdef VSOP87A_HAS_JUPITER
+   static void getJupiter(double t,double temp[],const vsop87a_mixed* mixed=nullptr);
+   static void getJupiterVel(double t,double temp[]);
+   static void getJupiterPosVel(double t,double pos[],double vel[]);
+   static void getJupiterBatch(const double* t,size_t n,double* xyz);
+   static const vsop87a_body jupiter_series;
+#endif
+#ifdef VSOP87A_HAS_MARS
+   static void getMars(double t,double temp[],const vsop87a_mixed* mixed=nullptr);
+   static void getMarsVel(double t,double temp[]);
+   static void getMarsPosVel(double t,double pos[],double vel[]);
+   static void getMarsBatch(const double* t,size_t n,double* xyz);
+   static const vsop87a_body mars_series;
+#endif
+#ifdef VSOP87A_HAS_MERCURY
+   static void getMercury(double t,double temp[],const vsop87a_mixed* mixed=nullptr);
+   static void getMercuryVel(double t,double temp[]);
+   static void getMercuryPosVel(double t,double pos[],double vel[]);
+   static void getMercuryBatch(const double* t,size_t n,double* xyz);
+   static const vsop87a_body mercury_series;
+#endif
+#ifdef VSOP87A_HAS_NEPTUNE
+   static void getNeptune(double t,double temp[],const vsop87a_mixed* mixed=nullptr);
+   static void getNeptuneVel(double t,double temp[]);
+   static void getNeptunePosVel(double t,double pos[],double vel[]);
+   static void getNeptuneBatch(const double* t,size_t n,double* xyz);
+   static const vsop87a_body neptune_series;
+#endif
+#ifdef VSOP87A_HAS_SATURN
+   static void getSaturn(double t,double temp[],const vsop87a_mixed* mixed=nullptr);
+   static void getSaturnVel(double t,double temp[]);
+   static void getSaturnPosVel(double t,double pos[],double vel[]);
+   static void getSaturnBatch(const double* t,size_t n,double* xyz);
+   static const vsop87a_body saturn_series;
+#endif
+#ifdef VSOP87A_HAS_URANUS
+   static void getUranus(double t,double temp[],const vsop87a_mixed* mixed=nullptr);
+   static void getUranusVel(double t,double temp[]);
+   static void getUranusPosVel(double t,double pos[],double vel[]);
+   static void getUranusBatch(const double* t,size_t n,double* xyz);
+   static const vsop87a_body uranus_series;
+#endif
+#ifdef VSOP87A_HAS_VENUS
+   static void getVenus(double t,double temp[],const vsop87a_mixed* mixed=nullptr);
+   static void getVenusVel(double t,double temp[]);
+   static void getVenusPosVel(double t,double pos[],double vel[]);
+   static void getVenusBatch(const double* t,size_t n,double* xyz);
+   static const vsop87a_body venus_series;
+#endif
    static void getMoon(double earth[], double emb[],double temp[]);
 
+   static void evaluate(const vsop87a_body& body,double t,double temp[],const vsop87a_mixed* mixed=nullptr);
+   static void evaluatePosVel(const vsop87a_body& body,double t,double pos[],double vel[]);
+   static void evaluateBatch(const vsop87a_body& body,const double* t,size_t n,double* xyz);
+
+   //Keeps, for every body and coordinate, only the terms needed so that the
+   //dropped ones (weighted by max |t|^k over [t0, t1]) add up to at most au.
+   //Returns the guaranteed truncation error bound, au <= 0 restores the full
+   //series. Affects every evaluation started afterwards, and bumps the table
+   //version so the fits (and vsop87a_mixed splits) made from the old tables
+   //are redone.
+   static double setTolerance(double au,double t0,double t1);
+   static double getTruncationError();
+   //The table evaluate() actually uses for body, truncated or not
+   static const vsop87a_body& active(const vsop87a_body& body);
+   //Bumped whenever the active tables change
+   static int getTableVersion();
+
+   //How far from its t0 (julian millennia) a vsop87a_mixed is used
+   static double getMixedSpan();
+};
+
+//Evaluates a body on the uniform grid t0 + i*h without transcendental calls.
+//Every term is kept as the phasor exp(i(B + C*t)) and rotated by exp(i*C*h)
+//each step, with an exact re-anchor every anchor_every steps to bound drift.
+class vsop87a_stepper{
+   public:
+   vsop87a_stepper();
+   void init(const vsop87a_body& body,double t0,double h);
+   //t off the grid (or behind it) restarts the grid at t
+   void get(double t,double temp[]);
+
+   int anchor_every;
+
+   private:
+   void anchor(long long i);
+   void advance();
+
+   double t0;
+   double h;
+   long long index;
+   int since_anchor;
+   //Term ranges for each coordinate and power of t
+   int offset[3][7];
+   std::vector<double> a,b,c,re,im,rc,rs;
+};
+
+//Evaluates several bodies at once, computing each distinct frequency only
+//once: cos(B + C*t) = cos(B)cos(C*t) - sin(B)sin(C*t), so all terms sharing C
+//(in any body, coordinate or power of t) need a single sincos of C*t, and
+//their amplitudes are folded with cos(B) and sin(B) beforehand.
+class vsop87a_shared{
+   public:
+   vsop87a_shared();
+   void init(const vsop87a_body* const bodies[],int count);
+   //temp holds x, y, z for each body in turn
+   void get(double t,double temp[]);
+
    private:
-   static double earth_x(double t);
-   static double earth_y(double t);
-   static double earth_z(double t);
-   static double emb_x(double t);
-   static double emb_y(double t);
-   static double emb_z(double t);
-   static double jupiter_x(double t);
-   static double jupiter_y(double t);
-   static double jupiter_z(double t);
-   static double mars_x(double t);
-   static double mars_y(double t);
-   static double mars_z(double t);
-   static double mercury_x(double t);
-   static double mercury_y(double t);
-   static double mercury_z(double t);
-   static double neptune_x(double t);
-   static double neptune_y(double t);
-   static double neptune_z(double t);
-   static double saturn_x(double t);
-   static double saturn_y(double t);
-   static double saturn_z(double t);
-   static double uranus_x(double t);
-   static double uranus_y(double t);
-   static double uranus_z(double t);
-   static double venus_x(double t);
-   static double venus_y(double t);
-   static double venus_z(double t);
+   const vsop87a_body* const* bodies;
+   int count;
+   int version;
+   std::vector<double> freq;
+   std::vector<double> sn,cs;
+   //cos(C*t), sin(C*t) for each frequency
+   std::vector<double> sc;
+   //A*cos(B), -A*sin(B) for each term, grouped by output slot (body,
+   //coordinate, power of t), and the index of its frequency
+   std::vector<double> pq;
+   std::vector<int> index;
+   std::vector<int> slot;
 };
 #endif